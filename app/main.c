@@ -1,7 +1,523 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include <readline/history.h>
 
-int main(void)
+#include "../src/lab.h"
+
+/**
+ * Workload driver: replays a trace of list operations against list_t and
+ * reports per operation latency percentiles. The trace has one operation per
+ * line, blank lines and lines starting with # are ignored:
+ *
+ *   add <value>       list_add of an int
+ *   remove <index>    list_remove_index, the data is freed
+ *   indexof <value>   list_indexof of an int
+ *   destroy           list_destroy, a fresh list is created for what follows
+ *   report            print the latency report so far (interactive use)
+ *
+ * With -b the input is a binary trace written by list_trace_open instead,
+ * replayed in timestamp order across threads. Every traced list is replayed on its own list_t with synthetic int data:
+ * adds and removes go in and out at the traced index, an indexof hit searches
+ * for the element at the traced index and a miss for a value that was never
+ * added, so the replay walks as far as the original. A lookup the filter of
+ * the original list ruled out is replayed as a miss on an empty list with a
+ * filter, so it does not walk either. An unlink, whose index the trace does
+ * not know, removes the front node, which costs the same.
+ */
+
+/** The operations a trace can contain */
+enum trace_op
+{
+  OP_ADD,
+  OP_REMOVE,
+  OP_INDEXOF,
+  OP_UNLINK,
+  OP_DESTROY,
+  OP_COUNT
+};
+
+static const char *op_names[OP_COUNT] = { "add", "remove", "indexof", "unlink", "destroy" };
+
+/** Latency samples of one operation in nanoseconds */
+typedef struct samples
+{
+  unsigned long long *ns;
+  size_t len;
+  size_t cap;
+} samples_t;
+
+/** A list of a binary trace and the next value to add to it */
+typedef struct replay_list
+{
+  uint32_t id;
+  list_t *list;
+  int next_value;
+} replay_list_t;
+
+/** State of one replay */
+typedef struct driver
+{
+  list_t *list;
+  replay_list_t *lists; /* lists of a binary trace */
+  size_t nlists;
+  list_t *filter;       /* empty list with a filter, for filtered lookups */
+  samples_t samples[OP_COUNT];
+  size_t lineno;
+  size_t failed;    /* operations the list rejected, e.g. out of range removes */
+  size_t bad_lines; /* lines that could not be parsed */
+  bool verbose;     /* print the result of every operation */
+} driver_t;
+
+static void destroy_data(void *data)
+{
+  free(data);
+}
+
+static int compare_to(const void *a, const void *b)
+{
+  int fst = *(const int *)a;
+  int snd = *(const int *)b;
+  return (fst > snd) - (fst < snd);
+}
+
+static uint64_t hash_int(const void *data)
 {
-  printf("hello world\n");
-  return 0;
+  return (uint64_t)*(const int *)data;
+}
+
+static unsigned long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+static void record(samples_t *s, unsigned long long ns)
+{
+  if (s->len == s->cap)
+    {
+      size_t cap = s->cap ? s->cap * 2 : 1024;
+      unsigned long long *tmp = realloc(s->ns, cap * sizeof(*tmp));
+      if (tmp == NULL)
+        {
+          return; // Drop the sample rather than the replay
+        }
+      s->ns = tmp;
+      s->cap = cap;
+    }
+  s->ns[s->len++] = ns;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+  unsigned long long fst = *(const unsigned long long *)a;
+  unsigned long long snd = *(const unsigned long long *)b;
+  return (fst > snd) - (fst < snd);
+}
+
+/** Nearest rank percentile of sorted samples */
+static unsigned long long percentile(const samples_t *s, double p)
+{
+  size_t rank = (size_t)(p / 100.0 * (double)s->len + 0.5);
+  if (rank == 0)
+    {
+      rank = 1;
+    }
+  return s->ns[rank > s->len ? s->len - 1 : rank - 1];
+}
+
+static void report(driver_t *d, FILE *out)
+{
+  unsigned long long total_ns = 0;
+  size_t total_ops = 0;
+  fprintf(out, "%-8s %10s %12s %10s %10s %10s %10s\n", "op", "count", "total_ns",
+          "p50_ns", "p90_ns", "p99_ns", "max_ns");
+  for (int op = 0; op < OP_COUNT; op++)
+    {
+      samples_t *s = &d->samples[op];
+      if (s->len == 0)
+        {
+          continue;
+        }
+      qsort(s->ns, s->len, sizeof(*s->ns), cmp_ull);
+      unsigned long long sum = 0;
+      for (size_t i = 0; i < s->len; i++)
+        {
+          sum += s->ns[i];
+        }
+      fprintf(out, "%-8s %10zu %12llu %10llu %10llu %10llu %10llu\n", op_names[op], s->len, sum,
+              percentile(s, 50), percentile(s, 90), percentile(s, 99), s->ns[s->len - 1]);
+      total_ns += sum;
+      total_ops += s->len;
+    }
+  fprintf(out, "total: %zu ops in %llu ns, %zu failed, %zu bad lines\n", total_ops, total_ns,
+          d->failed, d->bad_lines);
+}
+
+static bool ensure_list(driver_t *d)
+{
+  if (d->list == NULL)
+    {
+      d->list = list_init(destroy_data, compare_to);
+    }
+  return d->list != NULL;
+}
+
+/** Parse and run one line of the trace, returns false on a malformed line */
+static bool execute(driver_t *d, char *line)
+{
+  char cmd[16];
+  long long arg = 0;
+  d->lineno++;
+
+  char *p = line + strspn(line, " \t");
+  if (*p == '\0' || *p == '\n' || *p == '#')
+    {
+      return true;
+    }
+  int n = sscanf(p, "%15s %lld", cmd, &arg);
+  if (n < 1)
+    {
+      return false;
+    }
+  if (strcmp(cmd, "report") == 0)
+    {
+      report(d, stdout);
+      return true;
+    }
+  if (!ensure_list(d))
+    {
+      fprintf(stderr, "Error: could not create list\n");
+      return false;
+    }
+
+  unsigned long long start;
+  if (strcmp(cmd, "add") == 0 && n == 2)
+    {
+      int *data = malloc(sizeof(int));
+      if (data == NULL)
+        {
+          return false;
+        }
+      *data = (int)arg;
+      start = now_ns();
+      list_t *rval = list_add(d->list, data);
+      record(&d->samples[OP_ADD], now_ns() - start);
+      if (rval == NULL)
+        {
+          free(data);
+          d->failed++;
+        }
+      if (d->verbose)
+        {
+          printf("size %zu\n", d->list->size);
+        }
+    }
+  else if (strcmp(cmd, "remove") == 0 && n == 2 && arg >= 0)
+    {
+      start = now_ns();
+      int *data = list_remove_index(d->list, (size_t)arg);
+      record(&d->samples[OP_REMOVE], now_ns() - start);
+      if (data == NULL)
+        {
+          d->failed++;
+        }
+      if (d->verbose)
+        {
+          data ? printf("removed %d\n", *data) : printf("nothing removed\n");
+        }
+      free(data);
+    }
+  else if (strcmp(cmd, "indexof") == 0 && n == 2)
+    {
+      int key = (int)arg;
+      start = now_ns();
+      int idx = list_indexof(d->list, &key);
+      record(&d->samples[OP_INDEXOF], now_ns() - start);
+      if (d->verbose)
+        {
+          printf("index %d\n", idx);
+        }
+    }
+  else if (strcmp(cmd, "destroy") == 0)
+    {
+      start = now_ns();
+      list_destroy(&d->list);
+      record(&d->samples[OP_DESTROY], now_ns() - start);
+    }
+  else
+    {
+      return false;
+    }
+  return true;
+}
+
+static void run_stream(driver_t *d, FILE *in)
+{
+  char *line = NULL;
+  size_t cap = 0;
+  while (getline(&line, &cap, in) != -1)
+    {
+      if (!execute(d, line))
+        {
+          fprintf(stderr, "line %zu: bad operation: %s", d->lineno, line);
+          d->bad_lines++;
+        }
+    }
+  free(line);
+}
+
+/** Find or create the list a binary trace record belongs to */
+static replay_list_t *replay_list(driver_t *d, uint32_t id)
+{
+  for (size_t i = 0; i < d->nlists; i++)
+    {
+      if (d->lists[i].id == id)
+        {
+          return &d->lists[i];
+        }
+    }
+  replay_list_t *tmp = realloc(d->lists, (d->nlists + 1) * sizeof(*tmp));
+  if (tmp == NULL)
+    {
+      return NULL;
+    }
+  d->lists = tmp;
+  replay_list_t *rl = &d->lists[d->nlists];
+  rl->list = list_init(destroy_data, compare_to);
+  if (rl->list == NULL)
+    {
+      return NULL;
+    }
+  rl->id = id;
+  rl->next_value = 0;
+  d->nlists++;
+  return rl;
+}
+
+/** Create the list filtered lookups are replayed on */
+static bool ensure_filter(driver_t *d)
+{
+  if (d->filter == NULL)
+    {
+      d->filter = list_init(destroy_data, compare_to);
+      if (d->filter != NULL && list_set_hash(d->filter, hash_int) != 0)
+        {
+          list_destroy(&d->filter);
+        }
+    }
+  return d->filter != NULL;
+}
+
+/** Replay one record of a binary trace */
+static void replay_record(driver_t *d, const list_trace_record_t *rec)
+{
+  replay_list_t *rl = replay_list(d, rec->list_id);
+  if (rl == NULL)
+    {
+      d->failed++;
+      return;
+    }
+
+  unsigned long long start;
+  if (rec->op == LIST_OP_ADD)
+    {
+      int *data = malloc(sizeof(int));
+      if (data == NULL)
+        {
+          d->failed++;
+          return;
+        }
+      *data = rl->next_value++;
+      start = now_ns();
+      list_t *rval = list_insert_at(rl->list, rec->index, data);
+      record(&d->samples[OP_ADD], now_ns() - start);
+      if (rval == NULL)
+        {
+          free(data);
+          d->failed++;
+        }
+    }
+  else if (rec->op == LIST_OP_REMOVE)
+    {
+      start = now_ns();
+      int *data = list_remove_index(rl->list, rec->index);
+      record(&d->samples[OP_REMOVE], now_ns() - start);
+      if (data == NULL)
+        {
+          d->failed++;
+        }
+      free(data);
+    }
+  else if (rec->op == LIST_OP_UNLINK)
+    {
+      if (rl->list->size == 0)
+        {
+          d->failed++;
+          return;
+        }
+      start = now_ns();
+      int *data = list_remove_node(rl->list, rl->list->head->next);
+      record(&d->samples[OP_UNLINK], now_ns() - start);
+      free(data);
+    }
+  else if (rec->op == LIST_OP_INDEXOF && rec->hit == LIST_TRACE_FILTERED)
+    {
+      if (!ensure_filter(d))
+        {
+          d->failed++;
+          return;
+        }
+      int key = -1;
+      start = now_ns();
+      list_indexof(d->filter, &key);
+      record(&d->samples[OP_INDEXOF], now_ns() - start);
+    }
+  else if (rec->op == LIST_OP_INDEXOF)
+    {
+      int key = -1; // Never added, so a miss walks the whole list
+      if (rec->hit)
+        {
+          if (rec->index >= rl->list->size)
+            {
+              d->failed++;
+              return;
+            }
+          node_t *curr = rl->list->head->next;
+          for (uint64_t i = 0; i < rec->index; i++)
+            {
+              curr = curr->next;
+            }
+          key = *(int *)curr->data;
+        }
+      start = now_ns();
+      list_indexof(rl->list, &key);
+      record(&d->samples[OP_INDEXOF], now_ns() - start);
+    }
+  else
+    {
+      d->bad_lines++;
+    }
+}
+
+static void run_binary(driver_t *d, FILE *in)
+{
+  // Replay in the order the operations happened, not the order the threads
+  // flushed them
+  list_trace_header_t header;
+  size_t count;
+  list_trace_record_t *recs = list_trace_read(in, &header, &count);
+  if (recs == NULL)
+    {
+      d->bad_lines++;
+      return;
+    }
+  for (size_t i = 0; i < count; i++)
+    {
+      replay_record(d, &recs[i]);
+    }
+  list_trace_free(recs);
+}
+
+static void run_interactive(driver_t *d)
+{
+  char *line;
+  d->verbose = true;
+  while ((line = readline("list> ")) != NULL)
+    {
+      if (*line)
+        {
+          add_history(line);
+        }
+      if (!execute(d, line))
+        {
+          fprintf(stderr, "bad operation: %s\n", line);
+          d->bad_lines++;
+        }
+      free(line);
+    }
+  printf("\n");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-h] [-i] [-b] [trace-file]\n"
+          "  Replays list operations from trace-file, or stdin when it is '-' or omitted.\n"
+          "  -i  interactive mode (the default when stdin is a terminal)\n"
+          "  -b  the trace is a binary trace written by list_trace_open\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  driver_t d = { 0 };
+  bool interactive = isatty(STDIN_FILENO);
+  bool binary = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "hib")) != -1)
+    {
+      switch (opt)
+        {
+        case 'i':
+          interactive = true;
+          break;
+        case 'b':
+          binary = true;
+          break;
+        case 'h':
+          usage(argv[0]);
+          return 0;
+        default:
+          usage(argv[0]);
+          return 1;
+        }
+    }
+
+  if (optind < argc && strcmp(argv[optind], "-") != 0)
+    {
+      FILE *in = fopen(argv[optind], "r");
+      if (in == NULL)
+        {
+          perror(argv[optind]);
+          return 1;
+        }
+      if (binary)
+        {
+          run_binary(&d, in);
+        }
+      else
+        {
+          run_stream(&d, in);
+        }
+      fclose(in);
+    }
+  else if (binary)
+    {
+      run_binary(&d, stdin);
+    }
+  else if (interactive)
+    {
+      run_interactive(&d);
+    }
+  else
+    {
+      run_stream(&d, stdin);
+    }
+
+  report(&d, stdout);
+  list_destroy(&d.list);
+  list_destroy(&d.filter);
+  for (size_t i = 0; i < d.nlists; i++)
+    {
+      list_destroy(&d.lists[i].list);
+    }
+  free(d.lists);
+  for (int op = 0; op < OP_COUNT; op++)
+    {
+      free(d.samples[op].ns);
+    }
+  return d.bad_lines ? 2 : 0;
 }
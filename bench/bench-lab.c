@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/lab.h"
+
+/**
+ * Micro benchmarks for the list library. Build with optimizations and without
+ * sanitizers through `make bench`, then run ./bench-lab <benchmark> [args].
+ */
+
+static void destroy_data(void *data)
+{
+  free(data);
+}
+
+static int compare_to(const void *a, const void *b)
+{
+  int fst = *(const int *)a;
+  int snd = *(const int *)b;
+  return (fst > snd) - (fst < snd);
+}
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/** Small xorshift generator so runs are repeatable */
+static unsigned long long rng_state = 88172645463325252ull;
+
+static unsigned long long rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+/**
+ * Build a list holding 0..n-1 front to back whose nodes are linked in random
+ * memory order, the way they end up after a long run of adds and removes.
+ */
+static list_t *scattered_list(size_t n)
+{
+  list_t *list = list_init(destroy_data, compare_to);
+  node_t **nodes = malloc(n * sizeof(*nodes));
+  if (list == NULL || nodes == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  for (size_t i = 0; i < n; i++)
+    {
+      int *data = malloc(sizeof(int));
+      *data = (int)i;
+      list_add(list, data);
+    }
+
+  // Shuffle the nodes and relink them in the new order
+  size_t i = 0;
+  for (node_t *curr = list->head->next; curr != list->head; curr = curr->next)
+    {
+      nodes[i++] = curr;
+    }
+  for (i = n - 1; i > 0; i--)
+    {
+      size_t j = rng() % (i + 1);
+      node_t *tmp = nodes[i];
+      nodes[i] = nodes[j];
+      nodes[j] = tmp;
+    }
+  node_t *prev = list->head;
+  for (i = 0; i < n; i++)
+    {
+      *(int *)nodes[i]->data = (int)i;
+      prev->next = nodes[i];
+      nodes[i]->prev = prev;
+      prev = nodes[i];
+    }
+  prev->next = list->head;
+  list->head->prev = prev;
+  free(nodes);
+  return list;
+}
+
+/**
+ * A/B of prefetching list walks: full length list_indexof scans over a list
+ * with scattered nodes, with prefetching off and at a few distances. The first
+ * scan after a change walks the chain and fills the jump array, the scans
+ * after it run over the array.
+ */
+static void bench_traverse(int argc, char **argv)
+{
+  size_t n = argc > 0 ? strtoull(argv[0], NULL, 10) : 1000000;
+  int rounds = argc > 1 ? atoi(argv[1]) : 10;
+  list_t *list = scattered_list(n);
+  list_set_jump_index(list, true);
+  int key = (int)n - 1; // The back element, so every scan walks the whole list
+  const unsigned distances[] = { 0, 2, 4, 8, 16 };
+
+  printf("%-10s %14s %14s %14s\n", "prefetch", "first ms", "steady ms", "steady ns/node");
+  for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++)
+    {
+      list_set_prefetch_distance(distances[d]);
+
+      // Any change throws the jump array away
+      int *tmp = malloc(sizeof(int));
+      *tmp = -1;
+      list_add(list, tmp);
+      free(list_remove_index(list, 0));
+
+      double start = now_sec();
+      list_indexof(list, &key);
+      double first = now_sec() - start;
+
+      start = now_sec();
+      for (int r = 0; r < rounds; r++)
+        {
+          list_indexof(list, &key);
+        }
+      double elapsed = (now_sec() - start) / rounds;
+      printf("%-10u %14.3f %14.3f %14.2f\n", distances[d], first * 1e3, elapsed * 1e3,
+             elapsed * 1e9 / (double)n);
+    }
+  list_set_prefetch_distance(8);
+  list_destroy(&list);
+}
+
+/**
+ * Scaling of list_indexof_parallel: full length searches over a list with
+ * scattered nodes using 1 to max threads, on an unchanged list and with an
+ * add and a remove before every search, which the segment index follows
+ * without a walk.
+ */
+static void bench_search(int argc, char **argv)
+{
+  size_t n = argc > 0 ? strtoull(argv[0], NULL, 10) : 10000000;
+  size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 8;
+  int rounds = argc > 2 ? atoi(argv[2]) : 5;
+  list_t *list = scattered_list(n);
+  int key = (int)n - 1;
+
+  list_indexof_parallel(list, &key, max); // Builds the segment index
+  printf("%-8s %12s %10s %14s %10s\n", "threads", "ms/search", "speedup", "ms/changed", "speedup");
+  double base = 0;
+  double changed_base = 0;
+  for (size_t t = 1; t <= max; t *= 2)
+    {
+      double start = now_sec();
+      for (int r = 0; r < rounds; r++)
+        {
+          list_indexof_parallel(list, &key, t);
+        }
+      double elapsed = (now_sec() - start) / rounds;
+
+      // The index follows the changes instead of being built again
+      start = now_sec();
+      for (int r = 0; r < rounds; r++)
+        {
+          int *tmp = malloc(sizeof(int));
+          *tmp = -1;
+          list_add(list, tmp);
+          free(list_remove_index(list, 1000));
+          list_indexof_parallel(list, &key, t);
+        }
+      double changed = (now_sec() - start) / rounds;
+      if (t == 1)
+        {
+          base = elapsed;
+          changed_base = changed;
+        }
+      printf("%-8zu %12.3f %10.2f %14.3f %10.2f\n", t, elapsed * 1e3, base / elapsed, changed * 1e3,
+             changed_base / changed);
+    }
+  list_destroy(&list);
+}
+
+/** Work done by the destructor of the destroy benchmark, in loop iterations */
+static unsigned destroy_cost = 200;
+
+/** A destructor that costs about as much as tearing down a small tree */
+static void expensive_destroy(void *data)
+{
+  volatile unsigned sink = 0;
+  for (unsigned i = 0; i < destroy_cost; i++)
+    {
+      sink += i;
+    }
+  free(data);
+}
+
+/**
+ * Scaling of list_destroy_parallel: wall clock teardown of a list with an
+ * expensive destructor using 1 to max threads.
+ */
+static void bench_destroy(int argc, char **argv)
+{
+  size_t n = argc > 0 ? strtoull(argv[0], NULL, 10) : 2000000;
+  size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 8;
+  destroy_cost = argc > 2 ? (unsigned)atoi(argv[2]) : 200;
+
+  printf("%-8s %12s %10s\n", "threads", "ms", "speedup");
+  double base = 0;
+  for (size_t t = 1; t <= max; t *= 2)
+    {
+      list_t *list = scattered_list(n);
+      list->destroy_data = expensive_destroy;
+      double start = now_sec();
+      list_destroy_parallel(&list, t);
+      double elapsed = now_sec() - start;
+      if (t == 1)
+        {
+          base = elapsed;
+        }
+      printf("%-8zu %12.3f %10.2f\n", t, elapsed * 1e3, base / elapsed);
+    }
+}
+
+/** Hash of an int key for the cache benchmark, mixes into all 64 bits */
+static uint64_t hash_int(const void *data)
+{
+  uint64_t x = (uint64_t)(unsigned)*(const int *)data;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/** Work of one thread of the cache benchmark */
+typedef struct lru_worker
+{
+  pthread_t thread;
+  list_lru_sharded_t *lru;
+  unsigned long long seed;
+  size_t ops;
+  size_t keys;
+} lru_worker_t;
+
+/** Look up random keys, putting the ones that miss like a read through cache */
+static void *lru_worker_main(void *arg)
+{
+  lru_worker_t *w = arg;
+  unsigned long long x = w->seed;
+  for (size_t i = 0; i < w->ops; i++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      int key = (int)(x % w->keys);
+      if (list_lru_sharded_get(w->lru, &key, NULL, NULL) == 0)
+        {
+          int *data = malloc(sizeof(int));
+          *data = key;
+          if (list_lru_sharded_put(w->lru, data) != 0)
+            {
+              free(data);
+            }
+        }
+    }
+  return NULL;
+}
+
+/** Run threads workers against a fresh cache, returns millions of ops per second */
+static double lru_run(size_t threads, size_t shards, size_t ops, size_t keys, list_lru_policy_t policy)
+{
+  list_lru_sharded_t *lru = list_lru_sharded_init(shards, keys / 2, hash_int, destroy_data, compare_to);
+  lru_worker_t *workers = calloc(threads, sizeof(*workers));
+  if (lru == NULL || workers == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  list_lru_sharded_set_policy(lru, policy);
+  double start = now_sec();
+  for (size_t i = 0; i < threads; i++)
+    {
+      workers[i] = (lru_worker_t){ .lru = lru, .seed = rng(), .ops = ops, .keys = keys };
+      pthread_create(&workers[i].thread, NULL, lru_worker_main, &workers[i]);
+    }
+  for (size_t i = 0; i < threads; i++)
+    {
+      pthread_join(workers[i].thread, NULL);
+    }
+  double elapsed = now_sec() - start;
+  free(workers);
+  list_lru_sharded_destroy(&lru);
+  return (double)(threads * ops) / elapsed / 1e6;
+}
+
+/**
+ * Contention on the cache: 1 to max threads doing read through lookups on a
+ * single locked LRU and on a sharded one, in total millions of ops per second.
+ * The policy is exact (move to front on every hit) or clock.
+ */
+static void bench_lru(int argc, char **argv)
+{
+  size_t max = argc > 0 ? strtoull(argv[0], NULL, 10) : 64;
+  size_t shards = argc > 1 ? strtoull(argv[1], NULL, 10) : 64;
+  size_t ops = argc > 2 ? strtoull(argv[2], NULL, 10) : 200000;
+  size_t keys = argc > 3 ? strtoull(argv[3], NULL, 10) : 100000;
+  list_lru_policy_t policy = argc > 4 && strcmp(argv[4], "clock") == 0 ? LIST_LRU_CLOCK : LIST_LRU_EXACT;
+
+  printf("%-8s %14s %14s %10s\n", "threads", "1 shard Mops", "sharded Mops", "scaling");
+  double base = 0;
+  for (size_t t = 1; t <= max; t *= 2)
+    {
+      double single = lru_run(t, 1, ops, keys, policy);
+      double sharded = lru_run(t, shards, ops, keys, policy);
+      if (t == 1)
+        {
+          base = sharded;
+        }
+      printf("%-8zu %14.2f %14.2f %10.2f\n", t, single, sharded, sharded / base);
+    }
+}
+
+/** A benchmark and the arguments it takes */
+typedef struct bench
+{
+  const char *name;
+  const char *args;
+  void (*run)(int argc, char **argv);
+} bench_t;
+
+static const bench_t benches[] = {
+  { "traverse", "[elements] [rounds]", bench_traverse },
+  { "search", "[elements] [max threads] [rounds]", bench_search },
+  { "destroy", "[elements] [max threads] [destructor cost]", bench_destroy },
+  { "lru", "[max threads] [shards] [ops per thread] [keys] [exact|clock]", bench_lru },
+};
+
+int main(int argc, char **argv)
+{
+  size_t nbench = sizeof(benches) / sizeof(benches[0]);
+  for (size_t i = 0; argc > 1 && i < nbench; i++)
+    {
+      if (strcmp(argv[1], benches[i].name) == 0)
+        {
+          benches[i].run(argc - 2, argv + 2);
+          return 0;
+        }
+    }
+
+  fprintf(stderr, "Usage: %s <benchmark> [args]\n", argv[0]);
+  for (size_t i = 0; i < nbench; i++)
+    {
+      fprintf(stderr, "  %s %s\n", benches[i].name, benches[i].args);
+    }
+  return 1;
+}
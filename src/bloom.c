@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/* Counters set per element */
+#define BLOOM_PROBES 4
+/* Counters per element the filter is sized for, about 2% false positives */
+#define BLOOM_COUNTERS_PER_ELEMENT 8
+/* Smallest filter, in counters */
+#define BLOOM_MIN_COUNTERS 1024
+/* A counter that reached this stays there, it can no longer count down safely */
+#define BLOOM_STUCK UINT8_MAX
+
+/**
+ * Mix the user hash so weak hashes (the identity on integers, say) still
+ * spread over the filter.
+ *
+ * @param hash the user hash
+ * @return the mixed hash
+ */
+static uint64_t bloom_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * Compute the counters of an element by double hashing.
+ *
+ * @param list the list with the filter
+ * @param data the element
+ * @param pos filled with BLOOM_PROBES counter positions
+ */
+static void bloom_probes(const list_t *list, const void *data, size_t pos[BLOOM_PROBES]) {
+    uint64_t hash = bloom_mix(list->hash(data));
+    uint64_t step = (hash >> 32) | 1;
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        pos[i] = (size_t)(hash + (uint64_t)i * step) & list->bloom_mask;
+    }
+}
+
+/**
+ * Count an element in the filter.
+ *
+ * @param list the list with a built filter
+ * @param data the element
+ */
+static void bloom_count(list_t *list, const void *data) {
+    size_t pos[BLOOM_PROBES];
+    bloom_probes(list, data, pos);
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        if (list->bloom[pos[i]] != BLOOM_STUCK) list->bloom[pos[i]]++;
+    }
+}
+
+/**
+ * Build the filter from scratch, sized for the current number of elements.
+ * On failure the filter is dropped and lookups go to the list until the next
+ * rebuild.
+ *
+ * @param list the list, its hash must be set
+ * @return true on success, false if out of memory
+ */
+bool list_bloom_rebuild(list_t *list) {
+    size_t counters = BLOOM_MIN_COUNTERS;
+    while (counters / BLOOM_COUNTERS_PER_ELEMENT < list->size * 2 && counters < SIZE_MAX / 4) {
+        counters *= 2; // Room to double before the next rebuild
+    }
+    list_mem_free(list->bloom);
+    list->bloom = list_mem_alloc(counters);
+    list->bloom_stale = list->bloom == NULL;
+    if (list->bloom == NULL) return false;
+    memset(list->bloom, 0, counters);
+    list->bloom_mask = counters - 1;
+
+    list_walk_t walk;
+    for (list_walk_begin(&walk, list, false); walk.curr != list->head; list_walk_next(&walk)) {
+        bloom_count(list, walk.curr->data);
+    }
+    return true;
+}
+
+/**
+ * Set the hash used by the filter in front of list_indexof.
+ *
+ * @param list the list
+ * @param hash hashes an element consistently with compare_to, NULL drops the filter
+ * @return 0 on success or -1 if out of memory, the filter is then built by a later add
+ */
+int list_set_hash(list_t *list, uint64_t (*hash)(const void *)) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    list->hash = hash;
+    if (hash == NULL) {
+        list_mem_free(list->bloom);
+        list->bloom = NULL;
+        list->bloom_stale = false;
+        return 0;
+    }
+    return list_bloom_rebuild(list) ? 0 : -1;
+}
+
+/**
+ * Count an element just added to the list.
+ *
+ * @param list the list
+ * @param data the element
+ */
+void list_bloom_add(list_t *list, const void *data) {
+    // A stale filter or one too full to stay accurate is built again, which
+    // counts data as well since it is in the list already
+    if (list->bloom_stale || list->size > (list->bloom_mask + 1) / BLOOM_COUNTERS_PER_ELEMENT) {
+        list_bloom_rebuild(list);
+        return;
+    }
+    bloom_count(list, data);
+}
+
+/**
+ * Uncount an element just removed from the list.
+ *
+ * @param list the list
+ * @param data the element
+ */
+void list_bloom_remove(list_t *list, const void *data) {
+    if (list->bloom_stale) return; // Built again by the next add
+    size_t pos[BLOOM_PROBES];
+    bloom_probes(list, data, pos);
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        if (list->bloom[pos[i]] != BLOOM_STUCK) list->bloom[pos[i]]--;
+    }
+}
+
+/**
+ * Update the filters after list_splice moved every element of other to list.
+ *
+ * @param list the list that got the elements
+ * @param other the list that is now empty
+ */
+void list_bloom_splice(list_t *list, list_t *other) {
+    // Positions are the hash masked to the filter size, so a filter folds
+    // into one of the same hash that is no larger by adding up counters
+    if (list->hash != NULL) {
+        if (list->hash == other->hash && !list->bloom_stale && !other->bloom_stale &&
+            list->bloom_mask <= other->bloom_mask &&
+            list->size <= (list->bloom_mask + 1) / BLOOM_COUNTERS_PER_ELEMENT) {
+            for (size_t i = 0; i <= other->bloom_mask; i++) {
+                uint8_t *counter = &list->bloom[i & list->bloom_mask];
+                unsigned sum = (unsigned)*counter + other->bloom[i];
+                *counter = sum >= BLOOM_STUCK || other->bloom[i] == BLOOM_STUCK ? BLOOM_STUCK : (uint8_t)sum;
+            }
+        } else {
+            list_bloom_rebuild(list);
+        }
+    }
+    if (other->hash != NULL) {
+        if (other->bloom_stale) {
+            list_bloom_rebuild(other);
+        } else {
+            memset(other->bloom, 0, other->bloom_mask + 1);
+        }
+    }
+}
+
+/**
+ * Check whether an element equal to data may be in the list. A stale filter
+ * may contain anything, it is only built again by the list's writers.
+ *
+ * @param list the list
+ * @param data the key
+ * @return false if it is certainly not in the list
+ */
+bool list_bloom_may_contain(const list_t *list, const void *data) {
+    if (list->bloom_stale) return true;
+    size_t pos[BLOOM_PROBES];
+    bloom_probes(list, data, pos);
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        if (list->bloom[pos[i]] == 0) return false;
+    }
+    return true;
+}
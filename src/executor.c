@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/**
+ * A task group: every task of one list_parallel_run call. The caller waits
+ * for pending to drop to zero.
+ */
+typedef struct task_group
+{
+    size_t pending;           /* Tasks not finished yet, protected by lock */
+    pthread_mutex_t lock;     /* Protects pending and the wait on done */
+    pthread_cond_t done;      /* Signalled when pending drops to zero */
+} task_group_t;
+
+/**
+ * One call fn(arg, index) of a task group.
+ */
+typedef struct task
+{
+    void (*fn)(void *, size_t);
+    void *arg;
+    size_t index;
+    task_group_t *group;
+} task_t;
+
+/**
+ * Double ended queue of tasks owned by one worker. The owner pushes and pops
+ * at the bottom so it works on what it queued last, while it is still in
+ * cache. Other threads steal from the top, taking the oldest work.
+ */
+typedef struct deque
+{
+    pthread_mutex_t lock;
+    task_t **items;   /* Ring of cap slots */
+    size_t cap;
+    size_t top;       /* Oldest task, where thieves steal */
+    size_t bottom;    /* One past the newest task, where the owner works */
+} deque_t;
+
+/**
+ * A worker thread and its deque.
+ */
+typedef struct worker
+{
+    pthread_t thread;
+    deque_t deque;
+    size_t id;
+} worker_t;
+
+/* The process wide executor, created once and shared by every list */
+static pthread_mutex_t exec_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exec_wakeup = PTHREAD_COND_INITIALIZER;
+static worker_t *workers = NULL;  /* Written under exec_lock, read atomically by find_task */
+static size_t nworkers = 0;       /* Written under exec_lock, read atomically by find_task */
+static bool started = false;
+static bool stopping = false;
+static size_t queued = 0;         /* Tasks sitting in deques, protected by exec_lock */
+static size_t next_deque = 0;     /* Round robin target for submissions from outside */
+static _Thread_local worker_t *self = NULL;
+
+/**
+ * Add a task at the bottom of a deque.
+ *
+ * @param dq the deque
+ * @param task the task
+ * @return true on success, false if the deque could not grow
+ */
+static bool deque_push(deque_t *dq, task_t *task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom - dq->top == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : 64;
+        task_t **items = list_mem_alloc(cap * sizeof(task_t *));
+        if (items == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return false;
+        }
+        for (size_t i = dq->top; i != dq->bottom; i++) {
+            items[i % cap] = dq->items[i % dq->cap];
+        }
+        list_mem_free(dq->items);
+        dq->items = items;
+        dq->cap = cap;
+    }
+    dq->items[dq->bottom % dq->cap] = task;
+    dq->bottom++;
+    pthread_mutex_unlock(&dq->lock);
+    return true;
+}
+
+/**
+ * Take the newest task from a deque, the owner's end.
+ *
+ * @param dq the deque
+ * @return the task or NULL if empty
+ */
+static task_t *deque_pop(deque_t *dq) {
+    task_t *task = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        dq->bottom--;
+        task = dq->items[dq->bottom % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+/**
+ * Take the oldest task from a deque, the thieves' end.
+ *
+ * @param dq the deque
+ * @return the task or NULL if empty
+ */
+static task_t *deque_steal(deque_t *dq) {
+    task_t *task = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        task = dq->items[dq->top % dq->cap];
+        dq->top++;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+/**
+ * Find a task to run: from our own deque first, then from the others.
+ *
+ * @return the task or NULL if every deque is empty
+ */
+static task_t *find_task(void) {
+    task_t *task = NULL;
+    size_t start = 0;
+    if (self != NULL) {
+        task = deque_pop(&self->deque);
+        start = self->id + 1;
+    }
+    // Workers are still being started while the first ones look for work
+    size_t n = __atomic_load_n(&nworkers, __ATOMIC_ACQUIRE);
+    worker_t *ws = __atomic_load_n(&workers, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; task == NULL && i < n; i++) {
+        task = deque_steal(&ws[(start + i) % n].deque);
+    }
+    if (task != NULL) {
+        pthread_mutex_lock(&exec_lock);
+        queued--;
+        pthread_mutex_unlock(&exec_lock);
+    }
+    return task;
+}
+
+/**
+ * Run a task and let its group know. The group lives on the stack of the
+ * caller of list_parallel_run, which returns as soon as it sees pending drop
+ * to zero under the lock, so the group must not be touched after unlocking.
+ *
+ * @param task the task
+ */
+static void run_task(task_t *task) {
+    task_group_t *group = task->group;
+    task->fn(task->arg, task->index);
+    pthread_mutex_lock(&group->lock);
+    if (--group->pending == 0) {
+        pthread_cond_signal(&group->done);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+/**
+ * Check whether every task of a group has finished.
+ *
+ * @param group the group
+ * @return true once pending is zero
+ */
+static bool group_done(task_group_t *group) {
+    pthread_mutex_lock(&group->lock);
+    bool done = group->pending == 0;
+    pthread_mutex_unlock(&group->lock);
+    return done;
+}
+
+/**
+ * Worker loop: run tasks while there are any, sleep until more are queued.
+ *
+ * @param arg the worker
+ * @return NULL
+ */
+static void *worker_main(void *arg) {
+    self = arg;
+    for (;;) {
+        task_t *task = find_task();
+        if (task != NULL) {
+            run_task(task);
+            continue;
+        }
+        pthread_mutex_lock(&exec_lock);
+        while (queued == 0 && !stopping) {
+            pthread_cond_wait(&exec_wakeup, &exec_lock);
+        }
+        bool done = stopping && queued == 0;
+        pthread_mutex_unlock(&exec_lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+/**
+ * Start the executor, caller holds exec_lock.
+ *
+ * @param n number of worker threads
+ * @return 0 on success or -1 on failure
+ */
+static int executor_start_locked(size_t n) {
+    stopping = false;
+    worker_t *ws = NULL;
+    if (n > 0) {
+        ws = list_mem_alloc(n * sizeof(worker_t));
+        if (ws == NULL) return -1;
+        memset(ws, 0, n * sizeof(worker_t));
+    }
+    __atomic_store_n(&workers, ws, __ATOMIC_RELEASE);
+    // A worker is only counted once its deque is ready to be stolen from
+    for (size_t i = 0; i < n; i++) {
+        worker_t *w = &ws[i];
+        pthread_mutex_init(&w->deque.lock, NULL);
+        w->id = i;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            pthread_mutex_destroy(&w->deque.lock);
+            break; // Make do with the workers we have
+        }
+        __atomic_store_n(&nworkers, i + 1, __ATOMIC_RELEASE);
+    }
+    started = true;
+    return 0;
+}
+
+/**
+ * Start the process wide executor.
+ *
+ * @param n number of worker threads, 0 for one per online CPU besides the caller
+ * @return 0 on success or -1 if it is already running or out of memory
+ */
+int list_executor_start(size_t n) {
+    pthread_mutex_lock(&exec_lock);
+    if (started) {
+        pthread_mutex_unlock(&exec_lock);
+        return -1;
+    }
+    if (n == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 1 ? (size_t)cpus - 1 : 0;
+    }
+    int rval = executor_start_locked(n);
+    pthread_mutex_unlock(&exec_lock);
+    return rval;
+}
+
+/**
+ * Stop the executor and join its workers.
+ */
+void list_executor_stop(void) {
+    pthread_mutex_lock(&exec_lock);
+    if (!started || stopping) {
+        pthread_mutex_unlock(&exec_lock);
+        return; // Not running, or another stop is joining the workers
+    }
+    stopping = true;
+    size_t n = nworkers;
+    worker_t *ws = workers;
+    pthread_cond_broadcast(&exec_wakeup);
+    pthread_mutex_unlock(&exec_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        pthread_join(ws[i].thread, NULL);
+    }
+
+    pthread_mutex_lock(&exec_lock);
+    __atomic_store_n(&workers, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&nworkers, 0, __ATOMIC_RELEASE);
+    started = false;
+    pthread_mutex_unlock(&exec_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        pthread_mutex_destroy(&ws[i].deque.lock);
+        list_mem_free(ws[i].deque.items);
+    }
+    list_mem_free(ws);
+}
+
+/**
+ * Number of worker threads of the executor.
+ *
+ * @return the number of workers, 0 if not running
+ */
+size_t list_executor_size(void) {
+    pthread_mutex_lock(&exec_lock);
+    size_t n = nworkers;
+    pthread_mutex_unlock(&exec_lock);
+    return n;
+}
+
+/**
+ * Run fn(arg, i) for every i in [0, ntasks) on the executor.
+ *
+ * @param ntasks number of calls
+ * @param fn the function to run
+ * @param arg passed to every call
+ * @return 0 on success or -1 if the work could not be handed out
+ */
+int list_parallel_run(size_t ntasks, void (*fn)(void *, size_t), void *arg) {
+    if (ntasks == 0) return 0;
+
+    // The first parallel operation starts the executor if nobody did
+    pthread_mutex_lock(&exec_lock);
+    if (!started) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        executor_start_locked(cpus > 1 ? (size_t)cpus - 1 : 0);
+    }
+    size_t n = nworkers;
+    worker_t *ws = workers;
+    if (ntasks > 1 && n > 0) {
+        // Count the tasks before any can be stolen, a thief uncounts them
+        queued += ntasks - 1;
+    }
+    pthread_mutex_unlock(&exec_lock);
+
+    if (ntasks == 1 || n == 0) {
+        for (size_t i = 0; i < ntasks; i++) {
+            fn(arg, i);
+        }
+        return 0;
+    }
+
+    task_t *tasks = list_mem_alloc(ntasks * sizeof(task_t));
+    if (tasks == NULL) {
+        pthread_mutex_lock(&exec_lock);
+        queued -= ntasks - 1;
+        pthread_mutex_unlock(&exec_lock);
+        return -1;
+    }
+    task_group_t group = { ntasks, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+    // Hand out every task but the first, which the caller runs itself. A
+    // worker queues on its own deque, anyone else spreads the tasks out.
+    for (size_t i = 1; i < ntasks; i++) {
+        tasks[i] = (task_t){ fn, arg, i, &group };
+        deque_t *dq = self != NULL ? &self->deque
+                                   : &ws[__atomic_fetch_add(&next_deque, 1, __ATOMIC_RELAXED) % n].deque;
+        if (!deque_push(dq, &tasks[i])) {
+            pthread_mutex_lock(&exec_lock);
+            queued--;
+            pthread_mutex_unlock(&exec_lock);
+            run_task(&tasks[i]);
+        }
+    }
+    pthread_mutex_lock(&exec_lock);
+    pthread_cond_broadcast(&exec_wakeup);
+    pthread_mutex_unlock(&exec_lock);
+
+    tasks[0] = (task_t){ fn, arg, 0, &group };
+    run_task(&tasks[0]);
+
+    // Help with whatever is queued until our group is done, then wait for
+    // the tasks still running elsewhere
+    while (!group_done(&group)) {
+        task_t *task = find_task();
+        if (task != NULL) {
+            run_task(task);
+            continue;
+        }
+        pthread_mutex_lock(&group.lock);
+        while (group.pending != 0) {
+            pthread_cond_wait(&group.done, &group.lock);
+        }
+        pthread_mutex_unlock(&group.lock);
+    }
+
+    pthread_mutex_destroy(&group.lock);
+    pthread_cond_destroy(&group.done);
+    list_mem_free(tasks);
+    return 0;
+}
@@ -1,8 +1,431 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "lab.h"
+#include "lab_internal.h"
+
+/* Nodes prefetched ahead of list walks (see list_set_prefetch_distance) */
+unsigned list_prefetch_distance = 8;
+
+/* Source of list ids */
+static uint32_t next_list_id = 0;
+
+/**
+ * An entry of the handle slot table of a list.
+ */
+typedef struct list_slot
+{
+    node_t *node;        /* The node, NULL while the entry is free */
+    uint32_t gen;        /* Bumped every time the entry is released */
+    uint32_t next_free;  /* Next free entry while this one is free, 0 ends the chain */
+} list_slot_t;
+
+/* Allocator used for the list, its sentinel and its nodes (see list_set_allocator) */
+static void *(*list_alloc_fn)(size_t) = malloc;
+static void (*list_free_fn)(void *) = free;
+
+/**
+ * Replace the allocator used for all memory owned by the library.
+ *
+ * @param alloc_fn malloc compatible function, NULL restores malloc
+ * @param free_fn free compatible function, NULL restores free
+ */
+void list_set_allocator(void *(*alloc_fn)(size_t), void (*free_fn)(void *)) {
+    list_alloc_fn = alloc_fn ? alloc_fn : malloc;
+    list_free_fn = free_fn ? free_fn : free;
+}
+
+/**
+ * Allocate memory through the configured allocator.
+ *
+ * @param size number of bytes
+ * @return pointer to the memory or NULL if out of memory
+ */
+void *list_mem_alloc(size_t size) {
+    return list_alloc_fn(size);
+}
+
+/**
+ * Release memory obtained from list_mem_alloc.
+ *
+ * @param ptr the memory to release
+ */
+void list_mem_free(void *ptr) {
+    list_free_fn(ptr);
+}
+
+/* Every block of nodes still in use, sorted by address, so a node can find
+ * the block it lives in without carrying a pointer to it */
+static node_block_t **blocks = NULL;
+static size_t blocks_len = 0;
+static size_t blocks_cap = 0;
+static pthread_rwlock_t blocks_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * Count the registered blocks at or below addr, blocks_lock must be held.
+ *
+ * @param addr the address to look for
+ * @return the number of blocks starting at or before addr
+ */
+static size_t blocks_below(const void *addr) {
+    size_t lo = 0;
+    size_t hi = blocks_len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)blocks[mid] <= (uintptr_t)addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Find the block a node lives in.
+ *
+ * @param node the node
+ * @return the block or NULL if the node was allocated on its own
+ */
+static node_block_t *node_block_of(const node_t *node) {
+    // Only nodes marked as living in a block need the registry, and such a
+    // node keeps its block registered until the node itself is freed
+    if (!(node->slot & LIST_NODE_IN_BLOCK)) return NULL;
+    pthread_rwlock_rdlock(&blocks_lock);
+    node_block_t *block = NULL;
+    size_t below = blocks_below(node);
+    if (below > 0 && node < blocks[below - 1]->nodes + blocks[below - 1]->capacity) {
+        block = blocks[below - 1];
+    }
+    pthread_rwlock_unlock(&blocks_lock);
+    return block;
+}
+
+/**
+ * Allocate a block of nodes, all of them counted as live.
+ *
+ * @param capacity number of nodes
+ * @return the block or NULL if out of memory
+ */
+node_block_t *list_block_alloc(size_t capacity) {
+    if (capacity > (SIZE_MAX - sizeof(node_block_t)) / sizeof(node_t)) return NULL;
+    node_block_t *block = list_alloc_fn(sizeof(node_block_t) + capacity * sizeof(node_t));
+    if (block == NULL) return NULL;
+    block->live = capacity;
+    block->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        block->nodes[i].hits = 0;
+        block->nodes[i].slot = LIST_NODE_IN_BLOCK;
+    }
+
+    pthread_rwlock_wrlock(&blocks_lock);
+    if (blocks_len == blocks_cap) {
+        size_t cap = blocks_cap ? 2 * blocks_cap : 16;
+        node_block_t **grown = list_alloc_fn(cap * sizeof(node_block_t *));
+        if (grown == NULL) {
+            pthread_rwlock_unlock(&blocks_lock);
+            list_free_fn(block);
+            return NULL;
+        }
+        if (blocks_len > 0) memcpy(grown, blocks, blocks_len * sizeof(node_block_t *));
+        list_free_fn(blocks);
+        blocks = grown;
+        blocks_cap = cap;
+    }
+    size_t pos = blocks_below(block);
+    memmove(&blocks[pos + 1], &blocks[pos], (blocks_len - pos) * sizeof(node_block_t *));
+    blocks[pos] = block;
+    blocks_len++;
+    pthread_rwlock_unlock(&blocks_lock);
+    return block;
+}
+
+/**
+ * Free a block of nodes, whatever is left in it.
+ *
+ * @param block the block
+ */
+void list_block_free(node_block_t *block) {
+    pthread_rwlock_wrlock(&blocks_lock);
+    size_t pos = blocks_below(block) - 1;
+    assert(blocks[pos] == block);
+    memmove(&blocks[pos], &blocks[pos + 1], (blocks_len - pos - 1) * sizeof(node_block_t *));
+    blocks_len--;
+    if (blocks_len == 0) {
+        list_free_fn(blocks);
+        blocks = NULL;
+        blocks_cap = 0;
+    }
+    pthread_rwlock_unlock(&blocks_lock);
+    list_free_fn(block);
+}
+
+/**
+ * Allocate a single node.
+ *
+ * @return the node or NULL if out of memory
+ */
+node_t *list_node_alloc(void) {
+    node_t *node = list_alloc_fn(sizeof(node_t));
+    if (node == NULL) return NULL;
+    node->hits = 0;
+    node->slot = 0;
+    return node;
+}
+
+/**
+ * Free a node, the block it lives in goes once its last node is freed.
+ *
+ * @param node the node to free
+ */
+void list_node_free(node_t *node) {
+    node_block_t *block = node_block_of(node);
+    if (block == NULL) {
+        list_free_fn(node);
+    } else if (__atomic_sub_fetch(&block->live, 1, __ATOMIC_ACQ_REL) == 0) {
+        list_block_free(block);
+    }
+}
+
+/**
+ * Append node at position pos of the jump array, growing it when needed.
+ *
+ * @param list the list
+ * @param pos the position of node, must equal list->jump_len
+ * @param node the node at that position
+ * @return true on success, false if the array could not grow
+ */
+bool list_jump_record(list_t *list, size_t pos, node_t *node) {
+    if (pos == list->jump_cap) {
+        size_t cap = list->jump_cap ? list->jump_cap * 2 : LIST_JUMP_MIN_SIZE;
+        if (cap < list->size) cap = list->size;
+        node_t **jump = list_alloc_fn(cap * sizeof(node_t *));
+        if (jump == NULL) return false;
+        if (list->jump != NULL) {
+            memcpy(jump, list->jump, pos * sizeof(node_t *));
+            list_free_fn(list->jump);
+        }
+        list->jump = jump;
+        list->jump_cap = cap;
+    }
+    list->jump[pos] = node;
+    list->jump_len = pos + 1;
+    return true;
+}
+
+/**
+ * Link node into the chain right after pos.
+ *
+ * @param list the list pos is in
+ * @param pos the node to insert after, may be the sentinel
+ * @param node the node to link
+ * @param index the position node ends up at or SIZE_MAX if not known, which
+ * costs the segment index its counts
+ */
+static void link_after(list_t *list, node_t *pos, node_t *node, size_t index) {
+    list->jump_len = 0;
+    node->next = pos->next;
+    node->prev = pos;
+    pos->next->prev = node;
+    pos->next = node;
+    if (list->segs) list_segs_linked(list, node, index);
+}
+
+/**
+ * Take node out of the chain, its own links are left dangling.
+ *
+ * @param list the list node is in
+ * @param node the node to unlink
+ * @param index the position of node or SIZE_MAX if not known
+ */
+static void unlink_node(list_t *list, node_t *node, size_t index) {
+    list->jump_len = 0;
+    if (node == list->compact_cursor) {
+        list->compact_cursor = node->next; // Compaction carries on with the next node
+    }
+    if (list->segs) list_segs_unlinking(list, node, index);
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+/**
+ * Make sure the slot table of the list has a free entry.
+ *
+ * @param list the list
+ * @return true on success, false if out of memory
+ */
+static bool slot_reserve(list_t *list) {
+    if (list->slot_free != 0) return true;
+    if (list->slots_cap >= UINT32_MAX / 2) return false;
+    uint32_t cap = list->slots_cap ? list->slots_cap * 2 : 16;
+    list_slot_t *slots = list_alloc_fn(cap * sizeof(list_slot_t));
+    if (slots == NULL) return false;
+    if (list->slots_cap > 0) {
+        memcpy(slots, list->slots, list->slots_cap * sizeof(list_slot_t));
+    }
+    // Chain up the new entries, entry 0 is never handed out
+    for (uint32_t i = list->slots_cap ? list->slots_cap : 1; i < cap; i++) {
+        slots[i].node = NULL;
+        slots[i].gen = 1;
+        slots[i].next_free = i + 1 < cap ? i + 1 : 0;
+    }
+    list->slot_free = list->slots_cap ? list->slots_cap : 1;
+    list_free_fn(list->slots);
+    list->slots = slots;
+    list->slots_cap = cap;
+    return true;
+}
+
+/**
+ * Give node a handle slot, a free entry must have been reserved.
+ *
+ * @param list the list node is in
+ * @param node the node
+ * @return the handle to the node
+ */
+static list_handle_t slot_acquire(list_t *list, node_t *node) {
+    uint32_t slot = list->slot_free;
+    list_slot_t *entry = &list->slots[slot];
+    list->slot_free = entry->next_free;
+    list->slots_live++;
+    entry->node = node;
+    node->slot = (node->slot & LIST_NODE_IN_BLOCK) | slot;
+    return (list_handle_t){ slot, entry->gen };
+}
+
+/**
+ * Release the handle slot of node, if it has one. Handles to it go stale.
+ *
+ * @param list the list node is in
+ * @param node the node
+ */
+static void slot_release(list_t *list, node_t *node) {
+    uint32_t slot = LIST_NODE_SLOT(node);
+    if (slot == 0) return;
+    list_slot_t *entry = &list->slots[slot];
+    entry->node = NULL;
+    if (++entry->gen == 0) entry->gen = 1; // Generation 0 is never valid
+    entry->next_free = list->slot_free;
+    list->slot_free = slot;
+    list->slots_live--;
+    node->slot &= LIST_NODE_IN_BLOCK;
+}
+
+/**
+ * Release the handle slots of the nodes from first to the sentinel.
+ *
+ * @param list the list the nodes are in
+ * @param first the first node
+ */
+static void slot_release_from(list_t *list, node_t *first) {
+    for (node_t *curr = first; list->slots_live > 0 && curr != list->head; curr = curr->next) {
+        slot_release(list, curr);
+    }
+}
+
+/**
+ * Find the node a handle refers to.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the node or NULL if the handle is stale
+ */
+node_t *list_handle_node(const list_t *list, list_handle_t handle) {
+    if (list == NULL || handle.slot == 0 || handle.slot >= list->slots_cap) return NULL;
+    const list_slot_t *entry = &list->slots[handle.slot];
+    return entry->gen == handle.gen ? entry->node : NULL;
+}
+
+/**
+ * Swap the data of a node, keeping the filter in step.
+ *
+ * @param list the list node is in
+ * @param node the node
+ * @param data the new data
+ * @return the old data
+ */
+static void *replace_data(list_t *list, node_t *node, void *data) {
+    void *old = node->data;
+    if (list->hash) list_bloom_remove(list, old);
+    node->data = data;
+    if (list->hash) list_bloom_add(list, data);
+    return old;
+}
+
+/**
+ * Tell whether the filter of the list rules data out.
+ *
+ * @param list the list
+ * @param data the key
+ * @return true if no element equal to data is in the list
+ */
+static bool filter_rejects(const list_t *list, const void *data) {
+    return list->hash != NULL && !list_bloom_may_contain(list, data);
+}
+
+/**
+ * Unlink and free a node, releasing its handle slot.
+ *
+ * @param list the list node is in
+ * @param node the node to remove
+ * @param index the position of node or SIZE_MAX if not known
+ * @return the data of the node
+ */
+static void *take_node(list_t *list, node_t *node, size_t index) {
+    void *data = node->data;
+    unlink_node(list, node, index);
+    slot_release(list, node);
+    list_node_free(node);
+    list->size--;
+    if (list->hash) list_bloom_remove(list, data);
+    return data;
+}
+
+/**
+ * End the compaction pass of the list, if any. The block gives up the
+ * reference the pass held, so it is freed with its last node.
+ *
+ * @param list the list
+ */
+static void compact_finish(list_t *list) {
+    node_block_t *block = list->compact_block;
+    if (block == NULL) return;
+    list->compact_block = NULL;
+    list->compact_cursor = NULL;
+    if (__atomic_sub_fetch(&block->live, 1, __ATOMIC_ACQ_REL) == 0) {
+        list_block_free(block);
+    }
+}
+
+/**
+ * Find the node at index, straight from the jump array if it reaches and
+ * otherwise walking from whichever end is closer.
+ *
+ * @param list the list
+ * @param index the position, the size gives the sentinel
+ * @return the node at index
+ */
+static node_t *node_at(list_t *list, size_t index) {
+    if (index < list->jump_len) return list->jump[index];
+
+    node_t *curr;
+    if (index <= list->size / 2) {
+        curr = list->head->next;
+        for (size_t i = 0; i < index; i++) {
+            curr = curr->next;
+        }
+    } else {
+        curr = list->head;
+        for (size_t i = list->size; i > index; i--) {
+            curr = curr->prev;
+        }
+    }
+    return curr;
+}
 
 /**
  * Create a new list with callbacks to deal with the data that the
@@ -10,30 +433,60 @@
  *
  * @param destroy_data Function that will free the memory for user supplied data
  * @param compare_to Function that will compare two user data elements
- * @return struct list* pointer to the newly allocated list.
+ * @return struct list* pointer to the newly allocated list or NULL if out of memory.
  */
 list_t *list_init(void (*destroy_data)(void *),int (*compare_to)(const void *, const void *)) {
-    list_t *list = (list_t*)malloc(sizeof(list_t)); // Allocate memory for the list
+    list_t *list = (list_t*)list_alloc_fn(sizeof(list_t)); // Allocate memory for the list
     // Check if the memory allocation was successful
     if (list == NULL) {
         fprintf(stderr, "Error: Memory allocation failed\n");
-        exit(1);
+        return NULL;
     }
 
     // Initialize the list
     list->destroy_data = destroy_data;
     list->compare_to = compare_to;
     list->size = 0;
-    list->head = (node_t*)malloc(sizeof(node_t)); // Allocate memory for the head/sentinel node
+    list->policy = LIST_POLICY_NONE;
+    list->id = __atomic_add_fetch(&next_list_id, 1, __ATOMIC_RELAXED);
+    list->jump = NULL;
+    list->jump_len = list->jump_cap = 0;
+    list->jump_enabled = false;
+    list->segs = NULL;
+    list->compact_block = NULL;
+    list->compact_pos = 0;
+    list->compact_cursor = NULL;
+    list->slots = NULL;
+    list->slots_cap = list->slots_live = list->slot_free = 0;
+    list->hash = NULL;
+    list->bloom = NULL;
+    list->bloom_mask = 0;
+    list->bloom_stale = false;
+    list->head = (node_t*)list_alloc_fn(sizeof(node_t)); // Allocate memory for the head/sentinel node
     // Check if the memory allocation was successful
     if (list->head == NULL) {
-        destroy_data(list);
+        list_free_fn(list); // Release the list itself, the caller still owns its data
         fprintf(stderr, "Error: Node memory allocation failed\n");
-        exit(1);
+        return NULL;
+    }
+
+#ifdef LIST_STATS
+    list->stats = (list_stats_t*)list_alloc_fn(sizeof(list_stats_t));
+    if (list->stats == NULL) {
+        list_free_fn(list->head);
+        list_free_fn(list);
+        fprintf(stderr, "Error: Stats memory allocation failed\n");
+        return NULL;
     }
+    list_stats_reset(list);
+#else
+    list->stats = NULL;
+#endif
 
     // Initialize the head/sentinel node
     list->head->data = NULL; // Sentinel node stores no data
+    list->head->hits = 0;
+    list->head->slot = 0;
     list->head->next = list->head; 
     list->head->prev = list->head; 
 
@@ -50,19 +503,44 @@ void list_destroy(list_t **list) {
     // Check if the list is NULL or if the pointer to the list is NULL
     if (list == NULL || *list == NULL) return;
 
+    list_free_all(*list);
+    *list = NULL; 
+}
+
+/**
+ * Free every node, its data, the sentinel and the list itself.
+ *
+ * @param list the list to release, must not be NULL
+ */
+void list_free_all(list_t *list) {
     // Free the memory allocated for the data in each node
-    node_t *curr = (*list)->head->next;
-    while (curr != (*list)->head) {
-        (*list)->destroy_data(curr->data);  // Call the destroy_data function pointer to free the memory allocated for the data
-        node_t *next = curr->next;          // Store the memory address of the next node in curr
-        free(curr);                         // Free the memory allocated for the current node
-        curr = next;                        // Move to the next node in the list
+    list_walk_t walk;
+    list_walk_begin(&walk, list, false);
+    while (walk.curr != list->head) {
+        node_t *curr = walk.curr;
+        list->destroy_data(curr->data);     // Call the destroy_data function pointer to free the memory allocated for the data
+        list_walk_next(&walk);              // Move to the next node before the current one goes away
+        list_node_free(curr);               // Free the memory allocated for the current node
     }
 
-    // Free the allocated memory for the list and node then set the list pointer to NULL
-    free((*list)->head); 
-    free(*list); 
-    *list = NULL; 
+    list_free_shell(list);
+}
+
+/**
+ * Free the sentinel and the list struct once every node is gone.
+ *
+ * @param list the list to release, must not be NULL
+ */
+void list_free_shell(list_t *list) {
+    // Free the allocated memory for the list and node
+    compact_finish(list);
+    list_free_fn(list->jump);
+    list_segs_free(list);
+    list_free_fn(list->slots);
+    list_free_fn(list->bloom);
+    list_free_fn(list->stats);
+    list_free_fn(list->head); 
+    list_free_fn(list); 
 }
 
 /**
@@ -70,7 +548,7 @@ void list_destroy(list_t **list) {
  *
  * @param list a pointer to an existing list.
  * @param data the data to add
- * @return A pointer to the list
+ * @return A pointer to the list or NULL if out of memory
  */
 list_t *list_add(list_t *list, void *data) {
     // Check if the list is NULL or if the data is NULL
@@ -84,26 +562,27 @@ list_t *list_add(list_t *list, void *data) {
         return list;
     }
 
+    LIST_STAT_START(start);
+
     // Create a new node to store the data
-    node_t *new_node = malloc(sizeof(node_t));
-    // Check if the memory allocation was successful
+    node_t *new_node = list_node_alloc();
+    // Check if the memory allocation was successful, the list is left untouched
     if (new_node == NULL) {
         fprintf(stderr, "Error: New node memory allocation failed\n");
-        return list;
+        return NULL;
     }
 
-    // Initialize the new node
+    // Initialize the new node and link it in after the sentinel
     new_node->data = data;
-    new_node->next = list->head->next;
-    new_node->prev = list->head;
-
-    // Update the pointers of adjacent nodes
-    list->head->next->prev = new_node;
-    list->head->next = new_node;
+    link_after(list, list->head, new_node, 0);
 
     // Increment the size of the list
     list->size++;
+    if (list->hash) list_bloom_add(list, data);
 
+    LIST_STAT_ADD(list, adds, 1);
+    LIST_STAT_END(list, LIST_OP_ADD, start);
+    LIST_TRACE_OP(list, LIST_OP_ADD, 0, true, 0);
     return list;
 }
 
@@ -126,60 +605,1029 @@ void *list_remove_index(list_t *list, size_t index) {
         return NULL;
     }
 
-    // Find the node at the specified index
-    node_t *curr = list->head->next;
-    for (size_t i = 0; i < index; i++) {
-        curr = curr->next;
+    LIST_STAT_START(start);
+
+    // Find the node at the specified index, straight from the jump array if it reaches
+    node_t *curr;
+    if (index < list->jump_len) {
+        curr = list->jump[index];
+    } else {
+        list_walk_t walk;
+        list_walk_begin(&walk, list, false); // The unlink below drops the jump array anyway
+        for (size_t i = 0; i < index; i++) {
+            list_walk_next(&walk);
+        }
+        curr = walk.curr;
     }
 
-    // Store the data to be removed
-    void *data = curr->data;
+    // Unlink and free the node, keeping its data
+    void *data = take_node(list, curr, index);
 
-    // Update the pointers of adjacent nodes
-    curr->prev->next = curr->next;
-    curr->next->prev = curr->prev;
+    LIST_STAT_ADD(list, removes, 1);
+    LIST_STAT_ADD(list, nodes_traversed, index + 1);
+    LIST_STAT_END(list, LIST_OP_REMOVE, start);
+    LIST_TRACE_OP(list, LIST_OP_REMOVE, index, true, index + 1);
+    return data;
+}
 
-    // Free the memory allocated for the node
-    free(curr);
+/**
+ * Remove the elements at many positions in one forward walk.
+ *
+ * @param list The list to remove the elements from
+ * @param indices strictly increasing positions in the list before the call
+ * @param n number of positions
+ * @param out_data filled with the removed data, NULL to destroy it
+ * @return number of elements removed or -1 if an index is out of order or out
+ * of bounds, n is above INT_MAX or there is no destroy_data to destroy the data with
+ */
+int list_remove_indices(list_t *list, const size_t *indices, size_t n, void **out_data) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
 
-    // Decrement the size of the list
-    list->size--;
+    if (n == 0) return 0;
+    if (indices == NULL) {
+        fprintf(stderr, "Error: Indices are NULL\n");
+        return -1;
+    }
 
-    return data;
+    if (out_data == NULL && list->destroy_data == NULL) {
+        fprintf(stderr, "Error: List has no destroy_data\n");
+        return -1;
+    }
+
+    // The count is returned as an int
+    if (n > INT_MAX) {
+        fprintf(stderr, "Error: Too many indices\n");
+        return -1;
+    }
+
+    // Check everything first so a bad index leaves the list untouched
+    for (size_t i = 0; i < n; i++) {
+        if (indices[i] >= list->size || (i > 0 && indices[i] <= indices[i - 1])) {
+            fprintf(stderr, "Error: Index out of bounds or out of order\n");
+            return -1;
+        }
+    }
+
+    LIST_STAT_START(start);
+
+    // Reach the first position from the closer end, walk forward from there
+    node_t *curr = node_at(list, indices[0]);
+    size_t pos = indices[0];
+    for (size_t i = 0; i < n; i++) {
+        while (pos < indices[i]) {
+            curr = curr->next;
+            pos++;
+        }
+        node_t *next = curr->next;
+        void *data = take_node(list, curr, indices[i] - i);
+        if (out_data != NULL) {
+            out_data[i] = data;
+        } else {
+            list->destroy_data(data);
+        }
+        // Replays as the same removals made one at a time
+        LIST_TRACE_OP(list, LIST_OP_REMOVE, indices[i] - i, true, indices[i] - i + 1);
+        curr = next;
+        pos++;
+    }
+
+    LIST_STAT_ADD(list, removes, n);
+    LIST_STAT_ADD(list, nodes_traversed, indices[n - 1] - indices[0] + 1);
+    LIST_STAT_END(list, LIST_OP_REMOVE, start);
+    return (int)n;
 }
 
 /**
- * Search for any occurrence of data from the list.
+ * Remove the first node whose data compares equal to data, finding and
+ * unlinking it in one walk.
  *
- * @param list the list to search for data
- * @param data the data to look for
- * @return The index of the item if found or -1 if not
+ * @param list the list to remove the element from
+ * @param data the data to compare against
+ * @return the data that was removed, now owned by the caller, or NULL if not found
  */
-int list_indexof(list_t *list, void *data) {
-    // Check if the list is NULL or if the data is NULL
+void *list_remove_data(list_t *list, void *data) {
     if (list == NULL) {
         fprintf(stderr, "Error: List is NULL\n");
-        return -1;
+        return NULL;
     }
 
     if (data == NULL) {
         fprintf(stderr, "Error: Data is NULL\n");
-        return -1;
+        return NULL;
     }
 
-    // Find the index of the data in the list
-    node_t *curr = list->head->next;
+    if (list->compare_to == NULL) {
+        fprintf(stderr, "Error: List has no compare_to\n");
+        return NULL;
+    }
+
+    if (filter_rejects(list, data)) {
+        LIST_STAT_ADD(list, filter_rejects, 1);
+        fprintf(stderr, "Error: Data not found in the list\n");
+        return NULL;
+    }
+
+    LIST_STAT_START(start);
+
+    list_walk_t walk;
+    list_walk_begin(&walk, list, false); // The jump array is stale after the unlink anyway
+    node_t *curr = walk.curr;
     size_t index = 0;
     while (curr != list->head) {
-        // Compare the data in the current node with the specified data
-        if (list->compare_to && list->compare_to(curr->data, data) == 0) {
-            return index;
+        if (list->compare_to(curr->data, data) == 0) {
+            void *rval = take_node(list, curr, index);
+
+            LIST_STAT_ADD(list, removes, 1);
+            LIST_STAT_ADD(list, nodes_traversed, index + 1);
+            LIST_STAT_ADD(list, comparisons, index + 1);
+            LIST_STAT_END(list, LIST_OP_REMOVE, start);
+            LIST_TRACE_OP(list, LIST_OP_REMOVE, index, true, index + 1);
+            return rval;
         }
-        curr = curr->next;
+        curr = list_walk_next(&walk);
         index++;
     }
 
-    // Data not found in the list
+    LIST_STAT_ADD(list, nodes_traversed, index);
+    LIST_STAT_ADD(list, comparisons, index);
     fprintf(stderr, "Error: Data not found in the list\n");
-    return -1;
-}
\ No newline at end of file
+    return NULL;
+}
+
+/**
+ * Remove a node the caller already holds, in O(1).
+ *
+ * @param list the list node is in
+ * @param node the node to remove, it is freed
+ * @return the data of the node, now owned by the caller, or NULL on invalid arguments
+ */
+void *list_remove_node(list_t *list, node_t *node) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    if (node == NULL || node == list->head) {
+        fprintf(stderr, "Error: Node is not in the list\n");
+        return NULL;
+    }
+
+    LIST_STAT_START(start);
+
+    void *data = take_node(list, node, SIZE_MAX);
+
+    // The position is not known without a walk, so this is traced as an unlink
+    LIST_STAT_ADD(list, removes, 1);
+    LIST_STAT_END(list, LIST_OP_UNLINK, start);
+    LIST_TRACE_OP(list, LIST_OP_UNLINK, SIZE_MAX, true, 0);
+    return data;
+}
+
+/**
+ * Add data to the front of the list and return a handle to it.
+ *
+ * @param list a pointer to an existing list
+ * @param data the data to add
+ * @return the handle or one with slot 0 if out of memory
+ */
+list_handle_t list_add_handle(list_t *list, void *data) {
+    list_handle_t none = { 0, 0 };
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return none;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return none;
+    }
+
+    // Reserve the slot first so a failure leaves the list untouched
+    if (!slot_reserve(list)) {
+        fprintf(stderr, "Error: Handle memory allocation failed\n");
+        return none;
+    }
+    if (list_add(list, data) == NULL) return none;
+    return slot_acquire(list, list->head->next);
+}
+
+/**
+ * Check whether a handle still refers to an element of the list.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return true if the element is still in the list
+ */
+bool list_handle_valid(const list_t *list, list_handle_t handle) {
+    return list_handle_node(list, handle) != NULL;
+}
+
+/**
+ * Get the data of an element.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the data or NULL if the handle is stale
+ */
+void *list_handle_get(const list_t *list, list_handle_t handle) {
+    node_t *node = list_handle_node(list, handle);
+    return node ? node->data : NULL;
+}
+
+/**
+ * Replace the data of an element.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @param data the new data
+ * @return the data that was replaced or NULL if data is NULL or the handle is stale
+ */
+void *list_handle_update(list_t *list, list_handle_t handle, void *data) {
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return NULL;
+    }
+
+    node_t *node = list_handle_node(list, handle);
+    if (node == NULL) {
+        fprintf(stderr, "Error: Stale handle\n");
+        return NULL;
+    }
+    return replace_data(list, node, data);
+}
+
+/**
+ * Move an element to the front of the list.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return 0 on success or -1 if the handle is stale
+ */
+int list_handle_move_to_front(list_t *list, list_handle_t handle) {
+    node_t *node = list_handle_node(list, handle);
+    if (node == NULL) {
+        fprintf(stderr, "Error: Stale handle\n");
+        return -1;
+    }
+    list_node_move_to_front(list, node);
+    return 0;
+}
+
+/**
+ * Move a node of the list to the front.
+ *
+ * @param list the list node is in
+ * @param node the node
+ */
+void list_node_move_to_front(list_t *list, node_t *node) {
+    if (node->prev == list->head) return;
+    unlink_node(list, node, SIZE_MAX);
+    link_after(list, list->head, node, 0);
+}
+
+/**
+ * Remove an element, the handle is stale afterwards.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the data that was removed or NULL if the handle is stale
+ */
+void *list_remove_handle(list_t *list, list_handle_t handle) {
+    node_t *node = list_handle_node(list, handle);
+    if (node == NULL) {
+        fprintf(stderr, "Error: Stale handle\n");
+        return NULL;
+    }
+
+    LIST_STAT_START(start);
+    void *data = take_node(list, node, SIZE_MAX);
+    LIST_STAT_ADD(list, removes, 1);
+    LIST_STAT_END(list, LIST_OP_UNLINK, start);
+    LIST_TRACE_OP(list, LIST_OP_UNLINK, SIZE_MAX, true, 0);
+    return data;
+}
+
+/**
+ * Insert data so that it ends up at index, walking from the closer end.
+ *
+ * @param list a pointer to an existing list
+ * @param index the position of the new node, the size appends
+ * @param data the data to add
+ * @return A pointer to the list or NULL if out of bounds or out of memory
+ */
+list_t *list_insert_at(list_t *list, size_t index, void *data) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return NULL;
+    }
+
+    if (index > list->size) {
+        fprintf(stderr, "Error: Index out of bounds\n");
+        return NULL;
+    }
+
+    LIST_STAT_START(start);
+
+    node_t *new_node = list_node_alloc();
+    if (new_node == NULL) {
+        fprintf(stderr, "Error: New node memory allocation failed\n");
+        return NULL;
+    }
+    new_node->data = data;
+    link_after(list, node_at(list, index)->prev, new_node, index);
+    list->size++;
+    if (list->hash) list_bloom_add(list, data);
+
+    LIST_STAT_ADD(list, adds, 1);
+    LIST_STAT_END(list, LIST_OP_ADD, start);
+    // node_at walked from whichever end was closer before the size went up
+    LIST_TRACE_OP(list, LIST_OP_ADD, index, true,
+                  index <= (list->size - 1) / 2 ? index : list->size - 1 - index);
+    return list;
+}
+
+/**
+ * Get the data at index without removing it, walking from the closer end.
+ *
+ * @param list the list
+ * @param index the position
+ * @return the data or NULL if out of bounds
+ */
+void *list_get(list_t *list, size_t index) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    if (index >= list->size) {
+        fprintf(stderr, "Error: Index out of bounds\n");
+        return NULL;
+    }
+    return node_at(list, index)->data;
+}
+
+/**
+ * Replace the data at index, walking from the closer end.
+ *
+ * @param list the list
+ * @param index the position
+ * @param data the new data
+ * @return the data that was replaced, now owned by the caller, or NULL if out of bounds
+ */
+void *list_set(list_t *list, size_t index, void *data) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return NULL;
+    }
+
+    if (index >= list->size) {
+        fprintf(stderr, "Error: Index out of bounds\n");
+        return NULL;
+    }
+    return replace_data(list, node_at(list, index), data);
+}
+
+/**
+ * Set the self organizing policy used by list_indexof.
+ *
+ * @param list the list to configure
+ * @param policy the policy to use from now on
+ */
+void list_set_policy(list_t *list, list_policy_t policy) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return;
+    }
+    list->policy = policy;
+}
+
+/**
+ * Turn the jump array of the list on or off.
+ *
+ * @param list the list to configure
+ * @param enabled true to build the jump array from now on
+ */
+void list_set_jump_index(list_t *list, bool enabled) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return;
+    }
+    list->jump_enabled = enabled;
+    if (!enabled) {
+        list_free_fn(list->jump);
+        list->jump = NULL;
+        list->jump_len = list->jump_cap = 0;
+    }
+}
+
+/**
+ * Relink a node that list_indexof just found according to the list policy.
+ *
+ * @param list the list the node is in
+ * @param node the node that was found
+ * @param index the position of node
+ */
+static void reorganize(list_t *list, node_t *node, size_t index) {
+    node_t *pos;
+    size_t to = index;
+    switch (list->policy) {
+    case LIST_POLICY_MOVE_TO_FRONT:
+        if (node->prev == list->head) return;
+        unlink_node(list, node, index);
+        link_after(list, list->head, node, 0);
+        break;
+    case LIST_POLICY_TRANSPOSE:
+        if (node->prev == list->head) return;
+        pos = node->prev->prev;
+        unlink_node(list, node, index);
+        link_after(list, pos, node, index - 1);
+        break;
+    case LIST_POLICY_FREQUENCY:
+        // Only walks past the nodes the hit count overtook, which is short
+        // once the counts have settled
+        if (node->hits < UINT32_MAX) node->hits++;
+        pos = node->prev;
+        while (pos != list->head && pos->hits < node->hits) {
+            pos = pos->prev;
+            to--;
+        }
+        if (pos == node->prev) return;
+        unlink_node(list, node, index);
+        link_after(list, pos, node, to);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Search for any occurrence of data from the list.
+ *
+ * @param list the list to search for data
+ * @param data the data to look for
+ * @return The index of the item if found or -1 if not
+ */
+int list_indexof(list_t *list, void *data) {
+    // Check if the list is NULL or if the data is NULL
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return -1;
+    }
+
+    LIST_STAT_START(start);
+
+    if (filter_rejects(list, data)) {
+        LIST_STAT_ADD(list, indexof_misses, 1);
+        LIST_STAT_ADD(list, filter_rejects, 1);
+        LIST_STAT_END(list, LIST_OP_INDEXOF, start);
+        LIST_TRACE_OP(list, LIST_OP_INDEXOF, 0, LIST_TRACE_FILTERED, 0);
+        fprintf(stderr, "Error: Data not found in the list\n");
+        return -1;
+    }
+
+    // Find the index of the data in the list. A reordering policy relinks the
+    // node found, which drops the jump array, so only extend it without one
+    list_walk_t walk;
+    list_walk_begin(&walk, list, list->policy == LIST_POLICY_NONE);
+    node_t *curr = walk.curr;
+    size_t index = 0;
+    while (curr != list->head) {
+        // Compare the data in the current node with the specified data
+        if (list->compare_to && list->compare_to(curr->data, data) == 0) {
+            LIST_STAT_ADD(list, indexof_hits, 1);
+            LIST_STAT_ADD(list, nodes_traversed, index + 1);
+            LIST_STAT_ADD(list, comparisons, index + 1);
+            reorganize(list, curr, index);
+            LIST_STAT_END(list, LIST_OP_INDEXOF, start);
+            LIST_TRACE_OP(list, LIST_OP_INDEXOF, index, true, index + 1);
+            return index;
+        }
+        curr = list_walk_next(&walk);
+        index++;
+    }
+
+    LIST_STAT_ADD(list, indexof_misses, 1);
+    LIST_STAT_ADD(list, nodes_traversed, index);
+    LIST_STAT_ADD(list, comparisons, list->compare_to ? index : 0);
+    LIST_STAT_END(list, LIST_OP_INDEXOF, start);
+    LIST_TRACE_OP(list, LIST_OP_INDEXOF, index, false, index);
+
+    // Data not found in the list
+    fprintf(stderr, "Error: Data not found in the list\n");
+    return -1;
+}
+
+/**
+ * Find the positions of many keys in one walk.
+ *
+ * @param list the list to search
+ * @param keys the keys
+ * @param n number of keys
+ * @param hash hashes keys and elements, NULL to use the hash of the list
+ * @param out_indices filled with the index of each key or -1
+ * @return number of keys found or -1 on invalid arguments, no hash or out of memory
+ */
+int list_indexof_many(list_t *list, void *const *keys, size_t n, uint64_t (*hash)(const void *),
+                      int *out_indices) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    if ((keys == NULL || out_indices == NULL) && n > 0) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return -1;
+    }
+
+    if (list->compare_to == NULL) {
+        fprintf(stderr, "Error: List has no compare_to\n");
+        return -1;
+    }
+
+    // Without a hash every node would be compared with every key
+    if (hash == NULL) hash = list->hash;
+    if (hash == NULL) {
+        fprintf(stderr, "Error: List has no hash\n");
+        return -1;
+    }
+
+    LIST_STAT_START(start);
+
+    // Keys that are found or ruled out by the filter are not pending
+    size_t *pending = list_alloc_fn((n ? n : 1) * sizeof(size_t));
+    if (pending == NULL) {
+        fprintf(stderr, "Error: Lookup memory allocation failed\n");
+        return -1;
+    }
+    size_t npending = 0;
+    for (size_t i = 0; i < n; i++) {
+        out_indices[i] = -1;
+        if (keys[i] != NULL && !filter_rejects(list, keys[i])) {
+            pending[npending++] = i;
+        }
+    }
+
+    // The pending keys go in a small open addressing set, each node then
+    // costs one hash and the compare_to calls of its bucket
+    size_t cap = 4;
+    while (cap < npending * 2) cap *= 2;
+    size_t *set = list_alloc_fn(cap * sizeof(size_t));
+    uint64_t *hashes = list_alloc_fn(cap * sizeof(uint64_t));
+    if (set == NULL || hashes == NULL) {
+        list_free_fn(set);
+        list_free_fn(hashes);
+        list_free_fn(pending);
+        fprintf(stderr, "Error: Lookup memory allocation failed\n");
+        return -1;
+    }
+    size_t mask = cap - 1;
+    for (size_t i = 0; i < cap; i++) set[i] = SIZE_MAX;
+    for (size_t i = 0; i < npending; i++) {
+        uint64_t key_hash = hash(keys[pending[i]]);
+        size_t pos = key_hash & mask;
+        while (set[pos] != SIZE_MAX) pos = (pos + 1) & mask;
+        set[pos] = pending[i];
+        hashes[pos] = key_hash;
+    }
+
+    size_t index = 0;
+    size_t comparisons = 0;
+    size_t left = npending;
+    list_walk_t walk;
+    list_walk_begin(&walk, list, true);
+    for (node_t *curr = walk.curr; left > 0 && curr != list->head; curr = list_walk_next(&walk), index++) {
+        uint64_t node_hash = hash(curr->data);
+        for (size_t pos = node_hash & mask; set[pos] != SIZE_MAX; pos = (pos + 1) & mask) {
+            size_t key = set[pos];
+            if (hashes[pos] != node_hash || out_indices[key] != -1) continue;
+            comparisons++;
+            if (list->compare_to(curr->data, keys[key]) == 0) {
+                out_indices[key] = (int)index;
+                left--;
+            }
+        }
+    }
+    size_t found = npending - left;
+
+    list_free_fn(set);
+    list_free_fn(hashes);
+    list_free_fn(pending);
+
+    LIST_STAT_ADD(list, indexof_hits, found);
+    LIST_STAT_ADD(list, indexof_misses, n - found);
+    LIST_STAT_ADD(list, filter_rejects, n - npending);
+    LIST_STAT_ADD(list, nodes_traversed, index);
+    LIST_STAT_ADD(list, comparisons, comparisons);
+    LIST_STAT_END(list, LIST_OP_INDEXOF, start);
+    return (int)found;
+}
+
+/**
+ * Open addressing set of the blocks list_memory_stats has already counted.
+ */
+typedef struct block_set
+{
+    node_block_t **slots; /* NULL marks a free slot */
+    size_t mask;          /* Slots minus one */
+    size_t count;         /* Blocks in the set */
+} block_set_t;
+
+/**
+ * Add block to the set, growing the set when it gets half full.
+ *
+ * @param set the set
+ * @param block the block to add
+ * @return 1 if block was added, 0 if it was already in the set or -1 if out of memory
+ */
+static int block_set_add(block_set_t *set, node_block_t *block) {
+    if (2 * (set->count + 1) > set->mask + 1) {
+        size_t cap = set->slots ? 2 * (set->mask + 1) : 64;
+        node_block_t **slots = list_alloc_fn(cap * sizeof(node_block_t *));
+        if (slots == NULL) return -1;
+        memset(slots, 0, cap * sizeof(node_block_t *));
+        for (size_t i = 0; set->slots != NULL && i <= set->mask; i++) {
+            if (set->slots[i] == NULL) continue;
+            size_t pos = ((uintptr_t)set->slots[i] * 0x9e3779b97f4a7c15ull >> 20) & (cap - 1);
+            while (slots[pos] != NULL) pos = (pos + 1) & (cap - 1);
+            slots[pos] = set->slots[i];
+        }
+        list_free_fn(set->slots);
+        set->slots = slots;
+        set->mask = cap - 1;
+    }
+    size_t pos = ((uintptr_t)block * 0x9e3779b97f4a7c15ull >> 20) & set->mask;
+    for (; set->slots[pos] != NULL; pos = (pos + 1) & set->mask) {
+        if (set->slots[pos] == block) return 0;
+    }
+    set->slots[pos] = block;
+    set->count++;
+    return 1;
+}
+
+/**
+ * Report how much memory the list is using.
+ *
+ * @param list the list to measure
+ * @param stats filled in with the memory usage of the list
+ * @param data_size optional function returning the bytes owned by one data element
+ * @return 0 on success or -1 if list or stats is NULL or out of memory
+ */
+int list_memory_stats(const list_t *list, list_memory_stats_t *stats, size_t (*data_size)(const void *)) {
+    if (list == NULL || stats == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    stats->nodes = list->size;
+    stats->node_bytes = list->size * sizeof(node_t);
+    stats->overhead_bytes = sizeof(list_t) + sizeof(node_t) + list->jump_cap * sizeof(node_t *) +
+                            list->slots_cap * sizeof(list_slot_t) + (list->bloom ? list->bloom_mask + 1 : 0) +
+                            (list->segs ? sizeof(list_segs_t) : 0) + (list->stats ? sizeof(list_stats_t) : 0);
+    stats->payload_bytes = 0;
+    stats->slack_bytes = 0;
+
+    // Count each block the nodes live in once. Neighbours mostly share a
+    // block, so only a node outside the last block found needs a search
+    block_set_t seen = { NULL, 0, 0 };
+    node_block_t *last = NULL;
+    list_walk_t walk;
+    for (list_walk_begin(&walk, (list_t *)list, false); walk.curr != list->head; list_walk_next(&walk)) {
+        node_t *curr = walk.curr;
+        bool in_last = last != NULL && curr >= last->nodes && curr < last->nodes + last->capacity;
+        node_block_t *block = in_last ? NULL : node_block_of(curr);
+        if (block != NULL) {
+            last = block;
+            int added = block_set_add(&seen, block);
+            if (added < 0) {
+                list_free_fn(seen.slots);
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                return -1;
+            }
+            if (added) {
+                size_t live = __atomic_load_n(&block->live, __ATOMIC_RELAXED);
+                stats->slack_bytes += (block->capacity - live) * sizeof(node_t);
+            }
+        }
+        // Payload sizes are only known to the user so ask for each element
+        if (data_size != NULL) {
+            stats->payload_bytes += data_size(curr->data);
+        }
+    }
+
+    list_free_fn(seen.slots);
+
+    stats->total_bytes = stats->node_bytes + stats->overhead_bytes + stats->payload_bytes +
+                         stats->slack_bytes;
+    return 0;
+}
+
+/**
+ * Call fn on the data of every element from front to back.
+ *
+ * @param list the list to walk
+ * @param fn called with the data of each element and ctx, returns non zero to stop
+ * @param ctx passed to fn
+ * @return 0 when every element was visited or the non zero value fn stopped with
+ */
+int list_foreach(list_t *list, int (*fn)(void *, void *), void *ctx) {
+    if (list == NULL || fn == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    list_walk_t walk;
+    for (list_walk_begin(&walk, list, true); walk.curr != list->head; list_walk_next(&walk)) {
+        int rval = fn(walk.curr->data, ctx);
+        if (rval != 0) return rval;
+    }
+    return 0;
+}
+
+/**
+ * Fold every element into an accumulator from front to back.
+ *
+ * @param list the list to reduce
+ * @param acc the accumulator, set up by the caller
+ * @param fn called with acc, the data of each element and ctx
+ * @param ctx passed to fn
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_reduce(list_t *list, void *acc, void (*fn)(void *, void *, void *), void *ctx) {
+    if (list == NULL || fn == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    list_walk_t walk;
+    for (list_walk_begin(&walk, list, true); walk.curr != list->head; list_walk_next(&walk)) {
+        fn(acc, walk.curr->data, ctx);
+    }
+    return 0;
+}
+
+/**
+ * Set how many nodes ahead of the visited node list walks prefetch.
+ *
+ * @param distance number of nodes, 0 turns prefetching off
+ */
+void list_set_prefetch_distance(unsigned distance) {
+    list_prefetch_distance = distance;
+}
+
+/**
+ * Compact the list a few nodes at a time.
+ *
+ * @param list the list to compact
+ * @param max_nodes the most nodes to move in this call
+ * @return 1 if there is more to do, 0 once the pass is complete or -1 if out of memory
+ */
+int list_compact_step(list_t *list, size_t max_nodes) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    if (list->compact_block == NULL) {
+        if (list->size == 0) return 0;
+        node_block_t *block = list_block_alloc(list->size);
+        if (block == NULL) {
+            fprintf(stderr, "Error: Compaction memory allocation failed\n");
+            return -1;
+        }
+        // The pass holds one reference, each node holds one once it is placed
+        block->live = 1;
+        list->compact_block = block;
+        list->compact_pos = 0;
+        list->compact_cursor = list->head->next;
+        if (list->segs) list->segs->compact_seg = 0;
+    }
+
+    node_block_t *block = list->compact_block;
+    node_t *curr = list->compact_cursor;
+    for (size_t moved = 0; moved < max_nodes && curr != list->head && list->compact_pos < block->capacity; moved++) {
+        // Put a copy of the node in the next free slot where the old node was
+        node_t *next = curr->next;
+        node_t *copy = &block->nodes[list->compact_pos++];
+        copy->data = curr->data;
+        copy->hits = curr->hits;
+        copy->slot = LIST_NODE_IN_BLOCK | curr->slot;
+        if (LIST_NODE_SLOT(copy) != 0) {
+            list->slots[LIST_NODE_SLOT(copy)].node = copy; // Handles follow the node to its new place
+        }
+        list_segs_t *segs = list->segs;
+        if (segs != NULL && segs->compact_seg < segs->n && segs->start[segs->compact_seg] == curr) {
+            segs->start[segs->compact_seg++] = copy; // So do segment starts, which come in list order
+        }
+        copy->next = next;
+        copy->prev = curr->prev;
+        curr->prev->next = copy;
+        next->prev = copy;
+        __atomic_add_fetch(&block->live, 1, __ATOMIC_RELAXED);
+        list_node_free(curr);
+        curr = next;
+    }
+    list->compact_cursor = curr;
+    list->jump_len = 0;
+
+    if (curr == list->head || list->compact_pos == block->capacity) {
+        compact_finish(list);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Move every node into one contiguous allocation in list order.
+ *
+ * @param list the list to compact
+ * @return 0 on success or -1 if out of memory
+ */
+int list_compact(list_t *list) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    // Start over so the whole list ends up in a single block
+    compact_finish(list);
+    return list_compact_step(list, SIZE_MAX) < 0 ? -1 : 0;
+}
+
+/**
+ * Link the chain first ... last in after pos in one go.
+ *
+ * @param pos the node to insert after, may be the sentinel
+ * @param first the first node of the chain
+ * @param last the last node of the chain
+ */
+static void link_chain_after(node_t *pos, node_t *first, node_t *last) {
+    last->next = pos->next;
+    first->prev = pos;
+    pos->next->prev = last;
+    pos->next = first;
+}
+
+/**
+ * Move every node of other into list, at the front or at the back. other is
+ * left empty. Both lists should use the same destroy_data since list now owns
+ * the data.
+ *
+ * @param list the list to move the nodes into
+ * @param other the list to take the nodes from
+ * @param at_front true to put them before the first node of list, false after the last
+ * @return 0 on success or -1 on invalid arguments
+ */
+int list_splice(list_t *list, list_t *other, bool at_front) {
+    if (list == NULL || other == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+    if (list == other) {
+        fprintf(stderr, "Error: Cannot splice a list into itself\n");
+        return -1;
+    }
+    if (other->size == 0) return 0;
+
+    // A compaction pass of other would otherwise carry on in list's chain
+    compact_finish(other);
+    slot_release_from(other, other->head->next);
+
+    node_t *first = other->head->next;
+    node_t *last = other->head->prev;
+    link_chain_after(at_front ? list->head : list->head->prev, first, last);
+    if (at_front) {
+        list->jump_len = 0;
+    } // At the back the positions already in the jump array do not change
+    if (list->segs) list_segs_spliced(list, first, other->size, at_front);
+    list_segs_free(other);
+    list->size += other->size;
+
+    other->head->next = other->head->prev = other->head;
+    other->size = 0;
+    other->jump_len = 0;
+
+    list_bloom_splice(list, other);
+    return 0;
+}
+
+/**
+ * Append every node of other to list and destroy the now empty other.
+ *
+ * @param list the list to append to
+ * @param other a pointer to the list to append, set to NULL
+ * @return list or NULL on invalid arguments
+ */
+list_t *list_concat(list_t *list, list_t **other) {
+    if (other == NULL || list_splice(list, *other, false) != 0) return NULL;
+    list_free_shell(*other);
+    *other = NULL;
+    return list;
+}
+
+/**
+ * Cut the list before node, everything from node to the end goes to a new
+ * list with the same callbacks and policy.
+ *
+ * @param list the list to split
+ * @param node the first node of the new list, may be the sentinel for an empty split
+ * @param count number of nodes from node to the end of the list
+ * @return the new list or NULL if out of memory
+ */
+static list_t *split_before(list_t *list, node_t *node, size_t count) {
+    list_t *rest = list_init(list->destroy_data, list->compare_to);
+    if (rest == NULL) return NULL;
+    rest->policy = list->policy;
+    rest->hash = list->hash;
+    if (count == 0) {
+        if (rest->hash) list_bloom_rebuild(rest);
+        return rest;
+    }
+
+    // The pass may have got past the cut, start it over next time
+    compact_finish(list);
+    slot_release_from(list, node);
+
+    node_t *last = list->head->prev;
+    node->prev->next = list->head;
+    list->head->prev = node->prev;
+    link_chain_after(rest->head, node, last);
+    rest->size = count;
+    list->size -= count;
+    if (list->hash) {
+        // Uncount what left rather than walk what stayed
+        for (node_t *curr = node; curr != rest->head; curr = curr->next) {
+            list_bloom_remove(list, curr->data);
+        }
+        list_bloom_rebuild(rest);
+    }
+    if (list->jump_len > list->size) {
+        list->jump_len = list->size; // The front of the jump array is still right
+    }
+    if (list->segs) list_segs_truncate(list);
+    return rest;
+}
+
+/**
+ * Split the list at index. The nodes from index to the end move to a new list
+ * with the same callbacks and policy, the first index nodes stay.
+ *
+ * @param list the list to split
+ * @param index the position of the first node to move, may equal the size
+ * @return the new list or NULL if out of bounds or out of memory
+ */
+list_t *list_split_at(list_t *list, size_t index) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    if (index > list->size) {
+        fprintf(stderr, "Error: Index out of bounds\n");
+        return NULL;
+    }
+
+    return split_before(list, node_at(list, index), list->size - index);
+}
+
+/**
+ * Split the list before node. node and every node after it move to a new list
+ * with the same callbacks and policy. Walks from node to the end of the list
+ * to count what moves.
+ *
+ * @param list the list to split
+ * @param node a node of list, the first one to move
+ * @return the new list or NULL if node is not in list or out of memory
+ */
+list_t *list_split_at_node(list_t *list, node_t *node) {
+    if (list == NULL || node == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    size_t count = 0;
+    for (node_t *curr = node; curr != list->head; curr = curr->next) {
+        if (++count > list->size) {
+            fprintf(stderr, "Error: Node is not in the list\n");
+            return NULL;
+        }
+    }
+    return split_before(list, node, count);
+}
@@ -4,6 +4,8 @@
 #define LAB_H
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -19,8 +21,71 @@ typedef struct node
     void *data;
     struct node *next;
     struct node *prev;
+    uint32_t hits;     /* Successful list_indexof lookups, used by LIST_POLICY_FREQUENCY, or
+                          the reference bit of an element in a LIST_LRU_CLOCK cache */
+    uint32_t slot;     /* Handle slot of the node in its list, 0 if it has no handle. The
+                          top bit is reserved for the library */
 } node_t;
 
+/**
+ * @brief Stable reference to an element, returned by list_add_handle. A handle
+ * stays valid while the element is in the list, even as it moves around or is
+ * compacted. Once the element is removed, or moved to another list by
+ * list_splice or a split, the handle is stale and every list_handle_ function
+ * rejects it. The slot is reused later under a new generation.
+ */
+typedef struct list_handle
+{
+    uint32_t slot; /* Entry in the slot table of the list, 0 is never used */
+    uint32_t gen;  /* Generation of the entry when the handle was made */
+} list_handle_t;
+
+/**
+ * @brief Number of log2 latency buckets kept per operation. Bucket i counts
+ * operations that took [2^i, 2^(i+1)) nanoseconds, the last bucket also counts
+ * everything slower.
+ */
+#define LIST_LATENCY_BUCKETS 32
+
+/**
+ * @brief The list operations that are instrumented.
+ */
+typedef enum list_op
+{
+    LIST_OP_ADD,
+    LIST_OP_REMOVE,
+    LIST_OP_INDEXOF,
+    LIST_OP_UNLINK, /* Removal of a node the caller already holds, no walk */
+    LIST_OP_COUNT   /* Number of operations, not an operation */
+} list_op_t;
+
+/**
+ * @brief Per list operation counters and latency histograms. Only collected
+ * when the library is built with LIST_STATS defined.
+ */
+typedef struct list_stats
+{
+    uint64_t adds;             /* Elements added */
+    uint64_t removes;          /* Elements removed */
+    uint64_t indexof_hits;     /* list_indexof calls that found the data */
+    uint64_t indexof_misses;   /* list_indexof calls that did not */
+    uint64_t nodes_traversed;  /* Nodes visited while walking the list */
+    uint64_t comparisons;      /* Calls made to compare_to */
+    uint64_t filter_rejects;   /* Lookups the filter answered without a walk */
+    uint64_t latency[LIST_OP_COUNT][LIST_LATENCY_BUCKETS]; /* Latency histograms */
+} list_stats_t;
+
+/**
+ * @brief How the list reorganizes itself after list_indexof finds an element.
+ */
+typedef enum list_policy
+{
+    LIST_POLICY_NONE,          /* Never reorder, elements stay where they were added */
+    LIST_POLICY_MOVE_TO_FRONT, /* Move the element found to the front */
+    LIST_POLICY_TRANSPOSE,     /* Swap the element found with its predecessor */
+    LIST_POLICY_FREQUENCY      /* Keep the list ordered by number of lookups, most first */
+} list_policy_t;
+
 /**
  * @brief Struct to represent a list. The list maintains 2 function pointers to help
  * with the management of the data it is storing. These functions must be provided by the
@@ -32,8 +97,127 @@ typedef struct list
     int (*compare_to)(const void *, const void *); /* returns 0 if data are the same*/
     size_t size;                                   /* How many elements are in the list */
     struct node *head;                             /* sentinel node*/
+    list_stats_t *stats;                           /* Operation stats, NULL unless built with LIST_STATS */
+    list_policy_t policy;                          /* Self organizing search policy */
+    uint32_t id;                                   /* Process unique id, used in traces */
+    struct node **jump;                            /* Nodes in list order, valid for the first jump_len */
+    size_t jump_len;                               /* Valid entries in jump, reset by every change */
+    size_t jump_cap;                               /* Allocated entries in jump */
+    bool jump_enabled;                             /* Walks fill jump, see list_set_jump_index */
+    struct list_segs *segs;                        /* Segment index of the parallel operations, or NULL */
+    struct node_block *compact_block;              /* Block being filled by list_compact_step, or NULL */
+    size_t compact_pos;                            /* Next free node in compact_block */
+    struct node *compact_cursor;                   /* Next node list_compact_step will move */
+    struct list_slot *slots;                       /* Handle slot table, entry 0 unused */
+    uint32_t slots_cap;                            /* Allocated entries in slots */
+    uint32_t slots_live;                           /* Entries in use by a node */
+    uint32_t slot_free;                            /* First free entry, 0 if none */
+    uint64_t (*hash)(const void *);                /* Hashes an element for the filter, NULL if none */
+    uint8_t *bloom;                                /* Counting Bloom filter of the elements */
+    size_t bloom_mask;                             /* Counters in bloom minus one */
+    bool bloom_stale;                              /* bloom must be rebuilt before it is used */
 } list_t;
 
+/** @brief First bytes of a trace file ("LTRC" little endian) */
+#define LIST_TRACE_MAGIC 0x4352544cu
+/** @brief Version of the trace file layout */
+#define LIST_TRACE_VERSION 3
+/** @brief Trace timestamps are CPU timestamp counter ticks */
+#define LIST_TRACE_CLOCK_TSC 0
+/** @brief Trace timestamps are monotonic nanoseconds */
+#define LIST_TRACE_CLOCK_NS 1
+/** @brief list_trace_record_t.hit of a lookup the filter answered without a walk */
+#define LIST_TRACE_FILTERED 2
+
+/**
+ * @brief Header at the start of a trace file, followed by records until the
+ * end of the file. All values are in host byte order.
+ */
+typedef struct list_trace_header
+{
+    uint32_t magic;       /* LIST_TRACE_MAGIC */
+    uint32_t version;     /* LIST_TRACE_VERSION */
+    uint32_t record_size; /* sizeof(list_trace_record_t) */
+    uint32_t clock;       /* LIST_TRACE_CLOCK_TSC or LIST_TRACE_CLOCK_NS */
+} list_trace_header_t;
+
+/**
+ * @brief One traced operation. Records of different threads are interleaved
+ * in the file in the order they were flushed, list_trace_read merges them by tsc.
+ */
+typedef struct list_trace_record
+{
+    uint64_t tsc;       /* Timestamp, see list_trace_header_t.clock */
+    uint64_t index;     /* Index added at, removed or found, UINT64_MAX on a miss or an unlink */
+    uint64_t traversed; /* Nodes visited by the operation */
+    uint32_t list_id;   /* list_t.id of the list */
+    uint8_t op;         /* list_op_t */
+    uint8_t hit;        /* 0 if list_indexof did not find the data, 1 if it did or LIST_TRACE_FILTERED */
+    uint16_t reserved;
+} list_trace_record_t;
+
+/**
+ * @brief Memory used by a list as reported by list_memory_stats. All values
+ * are in bytes unless noted otherwise.
+ */
+typedef struct list_memory_stats
+{
+    size_t nodes;          /* Number of nodes allocated for elements */
+    size_t node_bytes;     /* Memory used by the element nodes */
+    size_t overhead_bytes; /* Memory used by the list struct, the sentinel, its stats and indexes */
+    size_t payload_bytes;  /* Memory reported by the data_size callback, 0 without one */
+    size_t slack_bytes;    /* Unused nodes held by the bulk allocated blocks the list's nodes live in */
+    size_t total_bytes;    /* Sum of all of the above */
+} list_memory_stats_t;
+
+/**
+ * @brief Callbacks that convert list data to and from bytes for list_save
+ * and list_load.
+ */
+typedef struct list_codec
+{
+    /* Write data to buf if it fits in cap bytes, return the size needed */
+    size_t (*encode)(const void *data, void *buf, size_t cap);
+    /* Create data from len bytes, return NULL on failure */
+    void *(*decode)(const void *buf, size_t len);
+} list_codec_t;
+
+/**
+ * @brief A read only list backed by a memory mapped snapshot, see list_view_open.
+ */
+typedef struct list_view list_view_t;
+
+/**
+ * @brief A least recently used cache built on list_t, see list_lru_init.
+ */
+typedef struct list_lru list_lru_t;
+
+/**
+ * @brief A thread safe cache split into independently locked LRU shards, see
+ * list_lru_sharded_init.
+ */
+typedef struct list_lru_sharded list_lru_sharded_t;
+
+/**
+ * @brief How a cache keeps track of recency, see list_lru_set_policy.
+ */
+typedef enum list_lru_policy
+{
+    LIST_LRU_EXACT, /* Move the element to the front on every hit */
+    LIST_LRU_CLOCK  /* Set a reference bit on a hit, second chance on eviction */
+} list_lru_policy_t;
+
+/**
+ * @brief Counters of a cache, see list_lru_stats.
+ */
+typedef struct list_lru_stats
+{
+    uint64_t hits;       /* list_lru_get calls that found the element */
+    uint64_t misses;     /* list_lru_get calls that did not */
+    uint64_t inserts;    /* Elements put, including replacements */
+    uint64_t evictions;  /* Elements dropped because the cache was full */
+} list_lru_stats_t;
+
 /**
  * @brief Create a new list with callbacks that know how to deal with the data that
  * list is storing. The caller must pass the list to list_destroy when finished to
@@ -41,7 +225,8 @@ typedef struct list
  *
  * @param destroy_data Function that will free the memory for user supplied data
  * @param compare_to Function that will compare two user data elements
- * @return struct list* pointer to the newly allocated list.
+ * @return struct list* pointer to the newly allocated list or NULL if memory
+ * could not be allocated.
  */
 list_t *list_init(void (*destroy_data)(void *),int (*compare_to)(const void *, const void *));
 
@@ -53,12 +238,25 @@ list_t *list_init(void (*destroy_data)(void *),int (*compare_to)(const void *, c
  */
 void list_destroy(list_t **list);
 
+/**
+ * @brief Destroy the list like list_destroy, calling destroy_data and freeing
+ * the nodes on up to nthreads threads at once. The list is split into
+ * segments through its segment index (see list_indexof_parallel).
+ * destroy_data must be safe to call from several threads at once. Lists too
+ * small to be worth splitting are destroyed with list_destroy.
+ *
+ * @param list a pointer to the list that needs to be destroyed, set to NULL
+ * @param nthreads the most threads to use, including the calling thread
+ */
+void list_destroy_parallel(list_t **list, size_t nthreads);
+
 /**
  * Adds data to the front of the list
  *
  * @param list a pointer to an existing list.
  * @param data the data to add
- * @return A pointer to the list
+ * @return A pointer to the list or NULL if memory for the new node could not be
+ * allocated. On failure the list is left untouched and the caller still owns data.
  */
 list_t *list_add(list_t *list, void *data);
 
@@ -72,11 +270,182 @@ list_t *list_add(list_t *list, void *data);
  */
 void *list_remove_index(list_t *list, size_t index);
 
+/**
+ * @brief Remove the elements at many positions in a single forward walk,
+ * O(n) overall instead of a walk per element. Positions refer to the list as
+ * it was before the call, so removing {1, 3} removes what were the second and
+ * fourth elements. Nothing is removed if a position is out of bounds or the
+ * positions are not strictly increasing.
+ *
+ * @param list The list to remove the elements from
+ * @param indices strictly increasing positions in the list before the call
+ * @param n number of positions
+ * @param out_data filled with the removed data in the order of indices, now
+ * owned by the caller. NULL to destroy the data with destroy_data instead,
+ * which the list must then have.
+ * @return number of elements removed or -1 on invalid arguments, including n
+ * above INT_MAX
+ */
+int list_remove_indices(list_t *list, const size_t *indices, size_t n, void **out_data);
+
+/**
+ * @brief Remove the first element that compares equal to data with
+ * compare_to. Finding and unlinking the node take a single walk.
+ *
+ * @param list the list to remove the element from
+ * @param data the data to compare against
+ * @return the data that was removed, now owned by the caller, or NULL if not found
+ */
+void *list_remove_data(list_t *list, void *data);
+
+/**
+ * @brief Remove a node the caller already holds in O(1), for example one
+ * reached by walking head->next. The node must be in list, this is not
+ * checked.
+ *
+ * @param list the list node is in
+ * @param node the node to remove, it is freed
+ * @return the data of the node, now owned by the caller, or NULL on invalid arguments
+ */
+void *list_remove_node(list_t *list, node_t *node);
+
+/**
+ * @brief Add data to the front of the list and return a handle to it, for O(1)
+ * access later on without searching.
+ *
+ * @param list a pointer to an existing list
+ * @param data the data to add
+ * @return the handle or one with slot 0 if out of memory
+ */
+list_handle_t list_add_handle(list_t *list, void *data);
+
+/**
+ * @brief Check whether a handle still refers to an element of the list.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return true if the element is still in the list
+ */
+bool list_handle_valid(const list_t *list, list_handle_t handle);
+
+/**
+ * @brief Get the data of an element in O(1).
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the data or NULL if the handle is stale
+ */
+void *list_handle_get(const list_t *list, list_handle_t handle);
+
+/**
+ * @brief Replace the data of an element in O(1).
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @param data the new data, must not be NULL
+ * @return the data that was replaced, now owned by the caller, or NULL if data
+ * is NULL or the handle is stale
+ */
+void *list_handle_update(list_t *list, list_handle_t handle, void *data);
+
+/**
+ * @brief Move an element to the front of the list in O(1).
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return 0 on success or -1 if the handle is stale
+ */
+int list_handle_move_to_front(list_t *list, list_handle_t handle);
+
+/**
+ * @brief Remove an element in O(1). The handle is stale afterwards.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the data that was removed, now owned by the caller, or NULL if the handle is stale
+ */
+void *list_remove_handle(list_t *list, list_handle_t handle);
+
+/**
+ * @brief Insert data so that it ends up at index. The position is reached
+ * from whichever end of the list is closer, so the walk is O(min(i, n - i)).
+ *
+ * @param list a pointer to an existing list
+ * @param index the position of the new node, 0 is the front and the size appends
+ * @param data the data to add
+ * @return A pointer to the list or NULL if out of bounds or out of memory
+ */
+list_t *list_insert_at(list_t *list, size_t index, void *data);
+
+/**
+ * @brief Find the index of many keys in a single walk of the list, stopping
+ * as soon as every key is found. The pending keys are kept in a small hash
+ * set and each node costs one hash, O(n + k) overall. The hash does not need
+ * the list to have a filter, but when list_set_hash gave it one the keys it
+ * rules out are not looked for. Unlike list_indexof the list is never
+ * reorganized, whatever its policy, so the indices are all positions in the
+ * same order of the list.
+ *
+ * @param list the list to search
+ * @param keys the keys, a NULL key is never found
+ * @param n number of keys
+ * @param hash hashes keys and elements, elements that compare equal must hash
+ * equal. NULL uses the hash given to list_set_hash.
+ * @param out_indices filled with the index of the first element equal to each
+ * key, or -1 if there is none
+ * @return number of keys found or -1 on invalid arguments, if there is no
+ * hash to use or out of memory
+ */
+int list_indexof_many(list_t *list, void *const *keys, size_t n, uint64_t (*hash)(const void *),
+                      int *out_indices);
+
+/**
+ * @brief Put a counting Bloom filter in front of lookups. list_indexof,
+ * list_indexof_parallel, list_remove_data and list_indexof_many consult it
+ * and return a miss without walking the list when it rules the key out. It
+ * has no false negatives, and about 2% of misses still walk. The filter is
+ * kept up to date as elements are added and removed and grows with the list.
+ * list_splice folds the filter of the other list in, or rebuilds in one walk
+ * when the two filters do not fit, and a split builds the filter of the new
+ * list from its elements. Lookups only read the filter, so they can share the
+ * list. Data must not be changed in place in a way that changes its hash.
+ *
+ * @param list the list
+ * @param hash hashes an element, elements that compare equal must hash
+ * equal. NULL removes the filter.
+ * @return 0 on success or -1 if out of memory, lookups then walk until the
+ * filter is built by a later add
+ */
+int list_set_hash(list_t *list, uint64_t (*hash)(const void *));
+
+/**
+ * @brief Get the data at index without removing it, walking from whichever
+ * end is closer.
+ *
+ * @param list the list
+ * @param index the position
+ * @return the data or NULL if out of bounds
+ */
+void *list_get(list_t *list, size_t index);
+
+/**
+ * @brief Replace the data at index, walking from whichever end is closer.
+ *
+ * @param list the list
+ * @param index the position
+ * @param data the new data
+ * @return the data that was replaced, now owned by the caller, or NULL if out of bounds
+ */
+void *list_set(list_t *list, size_t index, void *data);
+
 /**
  * @brief Search for any occurrence of data from the list.
  * Internally this function will call compare_to on each item in the list
  * until a match is found or the end of the list is reached. If there are
  * multiple copies of the same data in the list the first one will be returned.
+ * If the list has a self organizing policy (see list_set_policy) the element
+ * found is relinked after the search, the index returned is the one it had
+ * before it was moved.
  *
  * @param list the list to search for data
  * @param data the data to look for
@@ -84,6 +453,653 @@ void *list_remove_index(list_t *list, size_t index);
  */
 int list_indexof(list_t *list, void *data);
 
+/**
+ * @brief Search for data like list_indexof, splitting the list into segments
+ * that are scanned at the same time by up to nthreads threads. The segments
+ * come from a segment index of the list: up to 64 node pointers and counts
+ * that adds and removes keep up to date. It is built by the first parallel
+ * operation on the list, and segments that later grew too long, or whose
+ * counts a removal by node or handle put off, are walked again in parallel
+ * first. Because of that the parallel operations write to the list and must
+ * not run at the same time as other calls on it. Scanning stops early in
+ * every segment past a match already found, and the lowest matching index is
+ * returned. compare_to must be safe to call from several threads at once. A
+ * parallel search never reorders the list. Lists too small to be worth
+ * splitting are searched with list_indexof, self organizing policy included.
+ *
+ * @param list the list to search for data
+ * @param data the data to look for
+ * @param nthreads the most threads to use, including the calling thread
+ * @return The index of the first match or -1 if not found
+ */
+int list_indexof_parallel(list_t *list, void *data, size_t nthreads);
+
+/**
+ * @brief Set the self organizing policy used by list_indexof. With skewed
+ * lookups this keeps the hot elements near the front so searches stay short.
+ * Indexes of elements change whenever a search reorders the list.
+ *
+ * @param list the list to configure
+ * @param policy the policy to use from now on
+ */
+void list_set_policy(list_t *list, list_policy_t policy);
+
+/**
+ * @brief Let walks over the list record the nodes they visit in a jump array,
+ * off by default. See list_foreach for what the array buys.
+ *
+ * WARNING: with the jump array on, read only calls such as list_indexof,
+ * list_foreach and list_reduce write to the list struct as they walk. They
+ * must then never run at the same time as any other call on the same list,
+ * even behind a reader lock. Turning the array off frees it.
+ *
+ * @param list the list to configure
+ * @param enabled true to build the jump array from now on
+ */
+void list_set_jump_index(list_t *list, bool enabled);
+
+/**
+ * @brief Report how much memory the list is using. Every element is visited
+ * once. A bulk allocated block shared with other lists is counted in full by
+ * each of them.
+ *
+ * @param list the list to measure
+ * @param stats filled in with the memory usage of the list
+ * @param data_size optional function returning the bytes owned by one data element
+ * @return 0 on success or -1 if list or stats is NULL or out of memory
+ */
+int list_memory_stats(const list_t *list, list_memory_stats_t *stats, size_t (*data_size)(const void *));
+
+/**
+ * @brief Copy the operation stats of the list.
+ *
+ * @param list the list to read the stats from
+ * @param stats filled in with a copy of the stats
+ * @return 0 on success or -1 if stats are not compiled in or an argument is NULL
+ */
+int list_stats(const list_t *list, list_stats_t *stats);
+
+/**
+ * @brief Clear all the operation stats of the list.
+ *
+ * @param list the list to reset
+ */
+void list_stats_reset(list_t *list);
+
+/**
+ * @brief Write the operation stats of the list in a human readable form or as
+ * a single JSON object. Empty latency buckets are omitted.
+ *
+ * @param list the list to dump
+ * @param out the stream to write to
+ * @param json true to write JSON, false for text
+ * @return 0 on success or -1 if stats are not compiled in or an argument is NULL
+ */
+int list_stats_dump(const list_t *list, FILE *out, bool json);
+
+/**
+ * @brief Start tracing every list_add, list_remove_index and list_indexof of
+ * every list to a binary file (see list_trace_header_t). Each thread buffers
+ * its records in its own ring without locking, rings are written out when
+ * they fill up, on list_trace_flush, on list_trace_close and at thread exit.
+ * Only available when the library is built with LIST_TRACE defined.
+ *
+ * @param path the file to create
+ * @return 0 on success or -1 on failure, if a trace is already open or tracing
+ * is not compiled in
+ */
+int list_trace_open(const char *path);
+
+/**
+ * @brief Write out the records buffered by every thread.
+ *
+ * @return 0 on success or -1 if no trace is open
+ */
+int list_trace_flush(void);
+
+/**
+ * @brief Stop tracing, write out everything buffered and close the file.
+ */
+void list_trace_close(void);
+
+/**
+ * @brief Read a trace file written by list_trace_open. Each thread writes its
+ * records out in batches, so the file interleaves threads in flush order. The
+ * records are merged back by tsc, records with equal timestamps keep their
+ * file order. Works whether or not tracing is compiled in.
+ *
+ * @param in the stream, at the start of the trace
+ * @param header filled with the header of the trace
+ * @param count filled with the number of records
+ * @return the records, to release with list_trace_free, or NULL if the stream
+ * is not a trace or out of memory
+ */
+list_trace_record_t *list_trace_read(FILE *in, list_trace_header_t *header, size_t *count);
+
+/**
+ * @brief Release records returned by list_trace_read.
+ *
+ * @param records the records, may be NULL
+ */
+void list_trace_free(list_trace_record_t *records);
+
+/**
+ * @brief Write the list to path as a binary snapshot: a checksummed header
+ * followed by every element, front to back, as a length prefixed record
+ * linked to its neighbours by file offset.
+ *
+ * @param list the list to save
+ * @param path the file to create
+ * @param codec how to encode the elements
+ * @return 0 on success or -1 on failure
+ */
+int list_save(const list_t *list, const char *path, const list_codec_t *codec);
+
+/**
+ * @brief Create a list from a snapshot written by list_save. The file is read
+ * in one pass and all the nodes come from a single allocation, which makes
+ * loading much cheaper than calling list_add for every element.
+ *
+ * @param path the snapshot to read
+ * @param codec how to decode the elements
+ * @param destroy_data Function that will free the memory for user supplied data
+ * @param compare_to Function that will compare two user data elements
+ * @return the new list or NULL if the file is missing, corrupt or out of memory
+ */
+list_t *list_load(const char *path, const list_codec_t *codec, void (*destroy_data)(void *),
+                  int (*compare_to)(const void *, const void *));
+
+/**
+ * @brief Map a snapshot written by list_save as a read only list without
+ * copying or decoding anything. Opening is O(1) whatever the size of the
+ * snapshot, pages are faulted in as the view is walked. Elements are seen in
+ * their encoded form. Records are bounds checked as they are visited, call
+ * list_view_verify to check the whole snapshot up front.
+ *
+ * @param path the snapshot to map
+ * @param compare_to compares the encoded data of an element (bytes and length)
+ * with a search key, returns 0 if they match. May be NULL if list_view_indexof
+ * is not used.
+ * @return the view or NULL if the file is missing or not a snapshot
+ */
+list_view_t *list_view_open(const char *path, int (*compare_to)(const void *, size_t, const void *));
+
+/**
+ * @brief Unmap the snapshot and free the view.
+ *
+ * @param view a pointer to the view, set to NULL
+ */
+void list_view_close(list_view_t **view);
+
+/**
+ * @brief Number of elements in the view.
+ *
+ * @param view the view
+ * @return the number of elements
+ */
+size_t list_view_size(const list_view_t *view);
+
+/**
+ * @brief Check the checksum of the whole snapshot, this reads every page.
+ *
+ * @param view the view
+ * @return 0 if the snapshot is intact, -1 if not
+ */
+int list_view_verify(const list_view_t *view);
+
+/**
+ * @brief Call fn on the encoded data of every element from front to back.
+ *
+ * @param view the view
+ * @param fn called with the bytes, length and ctx of each element, returns non
+ * zero to stop
+ * @param ctx passed to fn
+ * @return 0 when every element was visited, the non zero value fn stopped
+ * with, or -1 if a corrupt record was reached
+ */
+int list_view_foreach(const list_view_t *view, int (*fn)(const void *, size_t, void *), void *ctx);
+
+/**
+ * @brief Search the view for an element matching key with the compare_to
+ * function given to list_view_open.
+ *
+ * @param view the view to search
+ * @param key the key to look for
+ * @return the index of the first match or -1 if not found
+ */
+int list_view_indexof(const list_view_t *view, const void *key);
+
+/**
+ * @brief Call fn on the data of every element from front to back. Like every
+ * walk the library does, the walk prefetches the nodes ahead of the one being
+ * visited (see list_set_prefetch_distance). fn must not add or remove elements.
+ *
+ * With list_set_jump_index on, walks over lists of a few hundred elements or
+ * more also record the nodes they visit in a jump array, 8 bytes per element,
+ * which later walks use to load many nodes in parallel instead of one next
+ * pointer at a time. Any change to the list invalidates the array, so read
+ * mostly lists benefit most.
+ *
+ * @param list the list to walk
+ * @param fn called with the data of each element and ctx, returns non zero to stop
+ * @param ctx passed to fn
+ * @return 0 when every element was visited, the non zero value fn stopped
+ * with, or -1 if list or fn is NULL
+ */
+int list_foreach(list_t *list, int (*fn)(void *, void *), void *ctx);
+
+/**
+ * @brief Call fn on the data of every element like list_foreach, splitting
+ * the list into segments walked by up to nthreads threads at once (see
+ * list_indexof_parallel). Elements are visited in list order within a
+ * segment only. If fn returns non zero the other threads stop soon after and
+ * that value is returned. fn must be safe to call from several threads at once. Lists too
+ * small to be worth splitting are walked with list_foreach.
+ *
+ * @param list the list to walk
+ * @param fn called with the data of each element and ctx, returns non zero to stop
+ * @param ctx passed to fn
+ * @param nthreads the most threads to use, including the calling thread
+ * @return 0 when every element was visited, a non zero value fn stopped with,
+ * or -1 if list or fn is NULL
+ */
+int list_foreach_parallel(list_t *list, int (*fn)(void *, void *), void *ctx, size_t nthreads);
+
+/**
+ * @brief Create a new list holding fn(data, ctx) for every element, in the
+ * same order. The nodes of the new list come from a single allocation.
+ *
+ * @param list the list to map
+ * @param fn returns the data for the new list, NULL on failure
+ * @param ctx passed to fn
+ * @param destroy_data Function that will free the memory for the new data
+ * @param compare_to Function that will compare two new data elements
+ * @return the new list or NULL if fn failed or out of memory, any data fn
+ * created is destroyed with destroy_data in that case
+ */
+list_t *list_map(list_t *list, void *(*fn)(void *, void *), void *ctx,
+                 void (*destroy_data)(void *), int (*compare_to)(const void *, const void *));
+
+/**
+ * @brief list_map with fn called on up to nthreads threads at once. fn must
+ * be safe to call from several threads at once.
+ *
+ * @param list the list to map
+ * @param fn returns the data for the new list, NULL on failure
+ * @param ctx passed to fn
+ * @param destroy_data Function that will free the memory for the new data
+ * @param compare_to Function that will compare two new data elements
+ * @param nthreads the most threads to use, including the calling thread
+ * @return the new list or NULL if fn failed or out of memory
+ */
+list_t *list_map_parallel(list_t *list, void *(*fn)(void *, void *), void *ctx,
+                          void (*destroy_data)(void *), int (*compare_to)(const void *, const void *),
+                          size_t nthreads);
+
+/**
+ * @brief Fold every element into acc from front to back by calling
+ * fn(acc, data, ctx).
+ *
+ * @param list the list to reduce
+ * @param acc the accumulator, set up by the caller
+ * @param fn folds one element into the accumulator
+ * @param ctx passed to fn
+ * @return 0 on success or -1 if list or fn is NULL
+ */
+int list_reduce(list_t *list, void *acc, void (*fn)(void *, void *, void *), void *ctx);
+
+/**
+ * @brief Fold every element into an accumulator using up to nthreads threads.
+ * Each thread folds one segment of the list into its own accumulator, the
+ * partial results are then folded into the first accumulator in list order
+ * with combine(acc, partial, ctx), so fn and combine need to be associative
+ * but not commutative. Lists too small to be worth splitting are folded into
+ * the first accumulator with list_reduce.
+ *
+ * @param list the list to reduce
+ * @param accs array of nthreads accumulators of acc_size bytes each, all set
+ * to the identity value by the caller. The result ends up in the first one.
+ * @param acc_size size of one accumulator in bytes
+ * @param fn folds one element into an accumulator, must be thread safe
+ * @param combine folds a partial accumulator into the first one
+ * @param ctx passed to fn and combine
+ * @param nthreads the most threads to use and the number of accumulators
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_reduce_parallel(list_t *list, void *accs, size_t acc_size,
+                         void (*fn)(void *, void *, void *), void (*combine)(void *, const void *, void *),
+                         void *ctx, size_t nthreads);
+
+/**
+ * @brief Set how many nodes ahead of the node being visited the walks in the
+ * library prefetch, 8 by default. 0 turns prefetching off and stops walks
+ * from filling the jump array of any list.
+ *
+ * @param distance number of nodes
+ */
+void list_set_prefetch_distance(unsigned distance);
+
+/**
+ * @brief Move every node into one contiguous allocation in list order. After
+ * a long run of adds and removes the nodes are scattered over the heap and
+ * each step of a walk is a cache miss, compacted nodes are next to each other
+ * in memory. Node pointers held by the caller are invalid afterwards.
+ *
+ * @param list the list to compact
+ * @return 0 on success or -1 if out of memory, the list is unchanged then
+ */
+int list_compact(list_t *list);
+
+/**
+ * @brief Move every node of other into list, at the front or at the back, by
+ * relinking the two chains in O(1). other is left empty and still has to be
+ * destroyed. Handles into other go stale, which costs a walk over its nodes if
+ * it has any. list owns the data from now on, so both lists should use the
+ * same destroy_data.
+ *
+ * @param list the list to move the nodes into
+ * @param other the list to take the nodes from
+ * @param at_front true to put them before the first node of list, false after the last
+ * @return 0 on success or -1 if a list is NULL or both are the same list
+ */
+int list_splice(list_t *list, list_t *other, bool at_front);
+
+/**
+ * @brief Append every node of other to list in O(1) and destroy the now empty
+ * other.
+ *
+ * @param list the list to append to
+ * @param other a pointer to the list to append, set to NULL on success
+ * @return list or NULL on invalid arguments
+ */
+list_t *list_concat(list_t *list, list_t **other);
+
+/**
+ * @brief Split the list in two at index. The nodes from index to the end move
+ * to a new list with the same callbacks and policy, the first index nodes
+ * stay. Finding the cut walks from the closer end, the cut itself is O(1).
+ * Handles to the nodes that move go stale, which costs a walk over them if
+ * the list has any.
+ *
+ * @param list the list to split
+ * @param index the position of the first node to move, the size gives an empty new list
+ * @return the new list or NULL if out of bounds or out of memory
+ */
+list_t *list_split_at(list_t *list, size_t index);
+
+/**
+ * @brief Split the list in two before node. node and every node after it move
+ * to a new list with the same callbacks and policy. Counting the nodes that
+ * move walks from node to the end of the list.
+ *
+ * @param list the list to split
+ * @param node a node of list, the first one to move
+ * @return the new list or NULL if node is not in list or out of memory
+ */
+list_t *list_split_at_node(list_t *list, node_t *node);
+
+/**
+ * @brief Compact the list a few nodes at a time so no single call pauses for
+ * long. The first call allocates room for every element, each call moves up
+ * to max_nodes of them in list order. The list can be used and changed
+ * between calls, elements added in front of the ones already moved are left
+ * where they are. Node pointers held by the caller are invalid for moved nodes.
+ *
+ * @param list the list to compact
+ * @param max_nodes the most nodes to move in this call
+ * @return 1 if there is more to do, 0 once the pass is complete (the next
+ * call starts a new one) or -1 if out of memory
+ */
+int list_compact_step(list_t *list, size_t max_nodes);
+
+/**
+ * @brief Start the process wide executor that runs the parallel list
+ * operations (list_indexof_parallel, list_destroy_parallel, list_map_parallel,
+ * list_reduce_parallel and list_foreach_parallel). Each worker has its own
+ * deque of tasks and steals from the others when it runs dry. The first
+ * parallel operation starts it with the default size if this was not called.
+ * The thread calling a parallel operation also runs tasks, so an executor
+ * with n workers runs up to n + 1 tasks at once.
+ *
+ * @param nworkers number of worker threads, 0 for one per online CPU besides
+ * the calling thread
+ * @return 0 on success or -1 if it is already running or out of memory
+ */
+int list_executor_start(size_t nworkers);
+
+/**
+ * @brief Stop the executor and join its workers. No parallel operation may be
+ * running. The next parallel operation starts it again.
+ */
+void list_executor_stop(void);
+
+/**
+ * @brief Number of worker threads of the executor.
+ *
+ * @return the number of workers, 0 if it is not running
+ */
+size_t list_executor_size(void);
+
+/**
+ * @brief Replace the allocator used for the list, its sentinel and its nodes.
+ * Every allocation made by the library goes through alloc_fn so a failing
+ * allocator can be installed to exercise the out of memory paths. Must only be
+ * called while no list is alive since memory is released with free_fn.
+ *
+ * @param alloc_fn malloc compatible function, NULL restores malloc
+ * @param free_fn free compatible function, NULL restores free
+ */
+void list_set_allocator(void *(*alloc_fn)(size_t), void (*free_fn)(void *));
+
+/**
+ * @brief Start the process wide background reclaimer. Lists passed to
+ * list_destroy_async and data passed to list_reclaim are destroyed on this
+ * thread instead of the caller's. destroy_data must therefore be safe to call
+ * from another thread.
+ *
+ * @return 0 on success or if already running, -1 if the thread could not be created
+ */
+int list_reclaimer_start(void);
+
+/**
+ * @brief Stop the background reclaimer. Blocks until everything that was
+ * handed off has been destroyed. While stopped, list_destroy_async and
+ * list_reclaim destroy inline on the calling thread.
+ */
+void list_reclaimer_stop(void);
+
+/**
+ * @brief Destroy the list without paying for the teardown on the calling
+ * thread. The list is detached in O(1) and *list set to NULL, the nodes and
+ * data are released later by the reclaimer.
+ *
+ * @param list a pointer to the list that needs to be destroyed
+ */
+void list_destroy_async(list_t **list);
+
+/**
+ * @brief Hand data removed from a list (for example by list_remove_index)
+ * to the reclaimer so destroy_data runs off the calling thread.
+ *
+ * @param destroy_data Function that will free the memory for data
+ * @param data the data to destroy
+ */
+void list_reclaim(void (*destroy_data)(void *), void *data);
+
+
+/**
+ * @brief Create a least recently used cache of at most capacity elements. The
+ * elements live in a list_t ordered by recency, the most recent at the front,
+ * with a hash index of handles next to it, so lookups, hits, inserts and
+ * evictions are all O(1). Elements act as their own keys: a key is anything
+ * compare_to and hash accept, typically a partially filled element. Not
+ * thread safe.
+ *
+ * @param capacity the most elements kept before the least recent is evicted
+ * @param hash hashes an element, elements that compare equal must hash equal
+ * @param destroy_data frees an element, called on eviction and replacement,
+ * must not be NULL since the cache owns its elements
+ * @param compare_to compares two elements, returns 0 if they are the same key
+ * @return the cache or NULL if out of memory or on invalid arguments
+ */
+list_lru_t *list_lru_init(size_t capacity, uint64_t (*hash)(const void *),
+                          void (*destroy_data)(void *), int (*compare_to)(const void *, const void *));
+
+/**
+ * @brief Destroy the cache and every element in it.
+ *
+ * @param lru a pointer to the cache, set to NULL
+ */
+void list_lru_destroy(list_lru_t **lru);
+
+/**
+ * @brief Choose how the cache tracks recency. LIST_LRU_EXACT, the default,
+ * moves an element to the front on every hit. LIST_LRU_CLOCK only sets the
+ * reference bit of the element on a hit and leaves the list alone. Eviction
+ * then scans from the back: a referenced element gets its bit cleared and a
+ * second chance at the front, the first unreferenced one is evicted. A hit
+ * thus leaves the list alone and only writes the bit while it is clear, which
+ * is what lets list_lru_sharded_get run under a shared lock. Hits and misses
+ * are counted on per thread stripes, apart from what lookups read.
+ *
+ * @param lru the cache
+ * @param policy the policy to use from now on
+ */
+void list_lru_set_policy(list_lru_t *lru, list_lru_policy_t policy);
+
+/**
+ * @brief Look up an element and mark it as used: it moves to the front, or
+ * under LIST_LRU_CLOCK gets its reference bit set.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, still owned by the cache, or NULL on a miss
+ */
+void *list_lru_get(list_lru_t *lru, const void *key);
+
+/**
+ * @brief Insert an element as the most recently used. An element with the
+ * same key is replaced and destroyed. Otherwise, when the cache is full, the
+ * least recently used element (head->prev) is evicted and destroyed first.
+ *
+ * @param lru the cache
+ * @param data the element, owned by the cache from now on
+ * @return 0 on success or -1 if out of memory, data is then still the caller's
+ * and the cache may have evicted an element to make room
+ */
+int list_lru_put(list_lru_t *lru, void *data);
+
+/**
+ * @brief Take an element out of the cache without destroying it.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, now owned by the caller, or NULL if not cached
+ */
+void *list_lru_remove(list_lru_t *lru, const void *key);
+
+/**
+ * @brief Number of elements in the cache.
+ *
+ * @param lru the cache
+ * @return the number of elements
+ */
+size_t list_lru_size(const list_lru_t *lru);
+
+/**
+ * @brief Copy the hit, miss, insert and eviction counters of the cache.
+ *
+ * @param lru the cache
+ * @param stats filled with the counters
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_lru_stats(const list_lru_t *lru, list_lru_stats_t *stats);
+
+/**
+ * @brief Create a thread safe cache made of nshards independent LRU caches,
+ * each with its own lock and an equal share of capacity. The high 32 bits of
+ * the hash pick the shard, so hash must mix its input into all 64 bits. Threads
+ * working on different shards never contend. Recency and eviction are per
+ * shard, so this is an approximation of a global LRU.
+ *
+ * @param nshards number of shards
+ * @param capacity the most elements kept over all shards, at least nshards
+ * @param hash hashes an element, elements that compare equal must hash equal
+ * @param destroy_data frees an element, called on eviction and replacement,
+ * must not be NULL since the cache owns its elements
+ * @param compare_to compares two elements, returns 0 if they are the same key
+ * @return the cache or NULL if out of memory or on invalid arguments
+ */
+list_lru_sharded_t *list_lru_sharded_init(size_t nshards, size_t capacity, uint64_t (*hash)(const void *),
+                                          void (*destroy_data)(void *),
+                                          int (*compare_to)(const void *, const void *));
+
+/**
+ * @brief Destroy the cache and every element in it. No other thread may be
+ * using it.
+ *
+ * @param lru a pointer to the cache, set to NULL
+ */
+void list_lru_sharded_destroy(list_lru_sharded_t **lru);
+
+/**
+ * @brief Set the policy of every shard, see list_lru_set_policy. With
+ * LIST_LRU_CLOCK lookups take the shard lock shared, so readers of the same
+ * shard no longer serialize. Must be called before the cache is shared
+ * between threads.
+ *
+ * @param lru the cache
+ * @param policy the policy to use from now on
+ */
+void list_lru_sharded_set_policy(list_lru_sharded_t *lru, list_lru_policy_t policy);
+
+/**
+ * @brief Look up an element and mark it as used in its shard, see
+ * list_lru_get. The element may be evicted by another thread as soon as the shard is
+ * unlocked, so it is handed to fn while the lock is held instead of returned.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @param fn called with the element and ctx on a hit, may be NULL
+ * @param ctx passed to fn
+ * @return 1 on a hit, 0 on a miss or -1 on invalid arguments
+ */
+int list_lru_sharded_get(list_lru_sharded_t *lru, const void *key, void (*fn)(void *, void *), void *ctx);
+
+/**
+ * @brief Insert an element into its shard, see list_lru_put.
+ *
+ * @param lru the cache
+ * @param data the element, owned by the cache from now on
+ * @return 0 on success or -1 if out of memory, data is then still the caller's
+ */
+int list_lru_sharded_put(list_lru_sharded_t *lru, void *data);
+
+/**
+ * @brief Take an element out of the cache without destroying it.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, now owned by the caller, or NULL if not cached
+ */
+void *list_lru_sharded_remove(list_lru_sharded_t *lru, const void *key);
+
+/**
+ * @brief Number of elements over all shards.
+ *
+ * @param lru the cache
+ * @return the number of elements
+ */
+size_t list_lru_sharded_size(list_lru_sharded_t *lru);
+
+/**
+ * @brief Sum the hit, miss, insert and eviction counters of every shard.
+ *
+ * @param lru the cache
+ * @param stats filled with the counters
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_lru_sharded_stats(list_lru_sharded_t *lru, list_lru_stats_t *stats);
 
 #ifdef __cplusplus
 } //extern "C"
@@ -0,0 +1,425 @@
+/* Helpers shared between the library sources, not part of the public API */
+
+#ifndef LAB_INTERNAL_H
+#define LAB_INTERNAL_H
+#include "lab.h"
+
+/**
+ * @brief Allocate memory through the allocator set with list_set_allocator.
+ *
+ * @param size number of bytes
+ * @return pointer to the memory or NULL if out of memory
+ */
+void *list_mem_alloc(size_t size);
+
+/**
+ * @brief Release memory obtained from list_mem_alloc.
+ *
+ * @param ptr the memory to release
+ */
+void list_mem_free(void *ptr);
+
+/**
+ * @brief A single allocation holding many nodes. The block is released once
+ * the last node in it is freed, wherever that node ended up. Nodes do not
+ * point at their block, live blocks are kept in a registry sorted by address
+ * that list_node_free searches for nodes marked LIST_NODE_IN_BLOCK.
+ */
+typedef struct node_block
+{
+    size_t live;      /* Nodes in the block that have not been freed yet */
+    size_t capacity;  /* Number of nodes in the block */
+    node_t nodes[];
+} node_block_t;
+
+/**
+ * @brief Allocate a block of capacity nodes, all of them counted as live.
+ *
+ * @param capacity number of nodes
+ * @return the block or NULL if out of memory
+ */
+node_block_t *list_block_alloc(size_t capacity);
+
+/** @brief Bit of node_t.slot set on every node that lives in a block */
+#define LIST_NODE_IN_BLOCK 0x80000000u
+
+/** @brief Handle slot of a node, without the LIST_NODE_IN_BLOCK bit */
+#define LIST_NODE_SLOT(node) ((node)->slot & ~LIST_NODE_IN_BLOCK)
+
+/**
+ * @brief Free a block of nodes at once, for a block whose nodes were never
+ * handed out one by one.
+ *
+ * @param block the block
+ */
+void list_block_free(node_block_t *block);
+
+/**
+ * @brief Allocate a single node.
+ *
+ * @return the node, with no block, or NULL if out of memory
+ */
+node_t *list_node_alloc(void);
+
+/**
+ * @brief Free a node, whether it was allocated on its own or in a block.
+ * Safe to call for nodes of the same block from several threads.
+ *
+ * @param node the node to free
+ */
+void list_node_free(node_t *node);
+
+/**
+ * @brief Find the node a handle refers to.
+ *
+ * @param list the list the handle came from
+ * @param handle the handle
+ * @return the node or NULL if the handle is stale
+ */
+node_t *list_handle_node(const list_t *list, list_handle_t handle);
+
+/**
+ * @brief Move a node of the list to the front.
+ *
+ * @param list the list node is in
+ * @param node the node
+ */
+void list_node_move_to_front(list_t *list, node_t *node);
+
+/**
+ * @brief Count an element just added to the list in its filter. Call only
+ * when list->hash is set, after the size was updated.
+ *
+ * @param list the list
+ * @param data the element
+ */
+void list_bloom_add(list_t *list, const void *data);
+
+/**
+ * @brief Uncount an element just removed from the list. Call only when
+ * list->hash is set.
+ *
+ * @param list the list
+ * @param data the element
+ */
+void list_bloom_remove(list_t *list, const void *data);
+
+/**
+ * @brief Update the filters of list and of the now empty other after
+ * list_splice moved the elements of other to list.
+ *
+ * @param list the list that got the elements
+ * @param other the list that gave them up
+ */
+void list_bloom_splice(list_t *list, list_t *other);
+
+/**
+ * @brief Build the filter of the list again from its elements. Call only
+ * when list->hash is set, with the list held exclusively.
+ *
+ * @param list the list
+ * @return true on success, false if out of memory, the filter then stays
+ * stale until the next add
+ */
+bool list_bloom_rebuild(list_t *list);
+
+/**
+ * @brief Check whether an element equal to data may be in the list, without
+ * writing to it. A stale filter answers that anything may be. Call only when
+ * list->hash is set.
+ *
+ * @param list the list
+ * @param data the key
+ * @return false if no element equal to data is in the list, true if one may be
+ */
+bool list_bloom_may_contain(const list_t *list, const void *data);
+
+/* How far ahead of the visited node list walks prefetch, 0 turns it off */
+extern unsigned list_prefetch_distance;
+
+/* Lists shorter than this are walked along the chain without a jump array */
+#define LIST_JUMP_MIN_SIZE 256
+
+/**
+ * @brief Append node at position pos of the jump array of the list, growing
+ * the array when needed.
+ *
+ * @param list the list
+ * @param pos the position of node, must equal list->jump_len
+ * @param node the node at that position
+ * @return true on success, false if the array could not grow
+ */
+bool list_jump_record(list_t *list, size_t pos, node_t *node);
+
+/* Fewest elements worth handing to a thread of a parallel operation */
+#define LIST_PARALLEL_MIN_CHUNK 4096
+
+/* Most segments the segment index of a list splits it into */
+#define LIST_SEGS_MAX 64
+
+/**
+ * @brief Segment index the parallel operations split a list with. Segment s
+ * runs from start[s] up to start[s + 1], or the sentinel for the last one.
+ * Adds and removes keep the start pointers right in O(1), or O(LIST_SEGS_MAX)
+ * when the position is known, so the index survives changes and only
+ * segments that grew too long are walked again (see list_segs_prepare).
+ */
+typedef struct list_segs
+{
+    size_t n;                     /* Segments in use, 0 once the list is empty */
+    size_t compact_seg;           /* First segment whose start list_compact_step has not reached */
+    bool dirty;                   /* A change at an unknown position left count off */
+    node_t *start[LIST_SEGS_MAX]; /* First node of each segment, in list order */
+    size_t count[LIST_SEGS_MAX];  /* Nodes in each segment */
+} list_segs_t;
+
+/**
+ * @brief Update the segment index after node was linked in.
+ *
+ * @param list the list, which has a segment index
+ * @param node the node just linked
+ * @param index the position of node or SIZE_MAX if not known
+ */
+void list_segs_linked(list_t *list, node_t *node, size_t index);
+
+/**
+ * @brief Update the segment index before node is unlinked.
+ *
+ * @param list the list, which has a segment index
+ * @param node the node about to be unlinked, still in the chain
+ * @param index the position of node or SIZE_MAX if not known
+ */
+void list_segs_unlinking(list_t *list, node_t *node, size_t index);
+
+/**
+ * @brief Update the segment index after count nodes starting with first were
+ * spliced in at the front or at the back.
+ *
+ * @param list the list, which has a segment index
+ * @param first the first node spliced in
+ * @param count number of nodes spliced in
+ * @param at_front true if they went before the old first node
+ */
+void list_segs_spliced(list_t *list, node_t *first, size_t count, bool at_front);
+
+/**
+ * @brief Cut the segment index down to the first list->size nodes after the
+ * rest of the list was split off. Dropped if its counts are off.
+ *
+ * @param list the list, which has a segment index
+ */
+void list_segs_truncate(list_t *list);
+
+/**
+ * @brief Free the segment index of the list, if any.
+ *
+ * @param list the list
+ */
+void list_segs_free(list_t *list);
+
+/**
+ * @brief Get the segment index of the list ready for a parallel operation:
+ * build it if missing and walk again, in parallel, the segments whose counts
+ * are off or that grew too long. Writes to the list.
+ *
+ * @param list the list
+ * @param ntasks the tasks the operation wants to split the list into
+ * @return the tasks to split the list into, 1 if the index could not be
+ * built and the operation should run inline
+ */
+size_t list_segs_prepare(list_t *list, size_t ntasks);
+
+/**
+ * @brief Find the nodes of a prepared list that task of ntasks works on:
+ * whole segments, [*first, *end) holding positions [*lo, *hi).
+ *
+ * @param list the list, prepared by list_segs_prepare
+ * @param ntasks number of tasks
+ * @param task which task
+ * @param first set to the first node of the task
+ * @param end set to the node after the last one of the task
+ * @param lo set to the position of *first
+ * @param hi set to the position of *end
+ */
+void list_segs_range(const list_t *list, size_t ntasks, size_t task,
+                     node_t **first, node_t **end, size_t *lo, size_t *hi);
+
+/**
+ * @brief Run fn(arg, i) for every i in [0, ntasks) in parallel on the process
+ * wide executor, starting it if needed. The calling thread takes part, so
+ * this may be called from inside a task. Returns once every call has finished.
+ *
+ * @param ntasks number of calls
+ * @param fn the function to run
+ * @param arg passed to every call
+ * @return 0 on success or -1 if the work could not be handed out, nothing has
+ * run in that case
+ */
+int list_parallel_run(size_t ntasks, void (*fn)(void *, size_t), void *arg);
+
+/**
+ * @brief Number of tasks to split n elements into for a parallel operation
+ * asked to use nthreads threads.
+ *
+ * @param n number of elements
+ * @param nthreads threads asked for
+ * @return number of tasks, 1 means the work should be done inline
+ */
+static inline size_t list_parallel_tasks(size_t n, size_t nthreads) {
+    size_t most = n / LIST_PARALLEL_MIN_CHUNK;
+    if (nthreads > most) nthreads = most;
+    return nthreads ? nthreads : 1;
+}
+
+/**
+ * @brief State of a prefetching walk over a list.
+ *
+ * Following next pointers is a chain of dependent loads, each costing a full
+ * memory latency once the nodes are scattered over the heap. Walks therefore
+ * go through the jump array of the list (all node pointers in list order) as
+ * far as it is valid, which lets the CPU load many nodes at once, and prefetch
+ * list_prefetch_distance positions ahead. Past the end of the array they
+ * follow the chain with a second pointer running ahead to prefetch nodes and
+ * data and, if asked to and the list has opted in with list_set_jump_index,
+ * extend the array as they go so the next walk is fast.
+ */
+typedef struct list_walk
+{
+    node_t *curr;  /* The node being visited, the sentinel once the walk is done */
+    node_t *ahead; /* The node being prefetched on the chain, NULL while on the array */
+    node_t *end;   /* The sentinel */
+    list_t *list;  /* The list being walked */
+    size_t pos;    /* Index of curr */
+    bool extend;   /* Record the nodes visited past the end of the jump array */
+} list_walk_t;
+
+/**
+ * @brief Point the chain prefetcher list_prefetch_distance nodes past curr.
+ *
+ * @param walk the walk
+ */
+static inline void list_walk_chain(list_walk_t *walk) {
+    walk->ahead = walk->curr;
+    for (unsigned i = 0; i < list_prefetch_distance && walk->ahead != walk->end; i++) {
+        __builtin_prefetch(walk->ahead->data);
+        walk->ahead = walk->ahead->next;
+        __builtin_prefetch(walk->ahead);
+    }
+}
+
+/**
+ * @brief Start a walk at the front of the list.
+ *
+ * @param walk the walk to start
+ * @param list the list to walk
+ * @param extend true to extend the jump array if the list has it enabled,
+ * false when the walk is about to change the list and would only throw the
+ * array away
+ */
+static inline void list_walk_begin(list_walk_t *walk, list_t *list, bool extend) {
+    walk->list = list;
+    walk->end = list->head;
+    walk->curr = list->head->next;
+    walk->pos = 0;
+    walk->extend = extend && list->jump_enabled && list->size >= LIST_JUMP_MIN_SIZE && list_prefetch_distance != 0;
+    if (list->jump_len > 0) {
+        walk->ahead = NULL;
+        for (size_t i = 1; i <= list_prefetch_distance && i < list->jump_len; i++) {
+            __builtin_prefetch(list->jump[i]);
+        }
+        return;
+    }
+    list_walk_chain(walk);
+    if (walk->extend && walk->curr != walk->end) {
+        walk->extend = list_jump_record(list, 0, walk->curr);
+    }
+}
+
+/**
+ * @brief Move the walk to the next node. Reads curr->next, so when the
+ * visited node is being freed call this before freeing it.
+ *
+ * @param walk the walk to advance
+ * @return the node now being visited
+ */
+static inline node_t *list_walk_next(list_walk_t *walk) {
+    list_t *list = walk->list;
+    size_t pos = ++walk->pos;
+    if (pos < list->jump_len) {
+        walk->curr = list->jump[pos];
+        size_t ahead = pos + list_prefetch_distance;
+        if (ahead < list->jump_len) {
+            __builtin_prefetch(list->jump[ahead]);
+        }
+        // Halfway there the node has arrived, so its data can be fetched
+        ahead = pos + list_prefetch_distance / 2;
+        if (list_prefetch_distance > 1 && ahead < list->jump_len) {
+            __builtin_prefetch(list->jump[ahead]->data);
+        }
+        return walk->curr;
+    }
+
+    walk->curr = walk->curr->next;
+    if (walk->ahead == NULL) {
+        // Just ran off the end of the jump array
+        list_walk_chain(walk);
+    } else if (walk->ahead != walk->end && list_prefetch_distance != 0) {
+        __builtin_prefetch(walk->ahead->data);
+        walk->ahead = walk->ahead->next;
+        __builtin_prefetch(walk->ahead);
+    }
+    if (walk->extend && pos == list->jump_len && walk->curr != walk->end) {
+        walk->extend = list_jump_record(list, pos, walk->curr);
+    }
+    return walk->curr;
+}
+
+/**
+ * @brief Free every node, call destroy_data on its data and release the
+ * sentinel and the list struct itself.
+ *
+ * @param list the list to release, must not be NULL
+ */
+void list_free_all(list_t *list);
+
+/**
+ * @brief Release the sentinel, the list struct and everything else the list
+ * owns apart from its nodes, which must already have been freed.
+ *
+ * @param list the list to release, must not be NULL
+ */
+void list_free_shell(list_t *list);
+
+#ifdef LIST_STATS
+/**
+ * @brief Current time in nanoseconds from a monotonic clock.
+ */
+uint64_t list_stats_now(void);
+
+/**
+ * @brief Record the latency of an operation that started at start.
+ */
+void list_stats_record(list_t *list, list_op_t op, uint64_t start);
+
+#define LIST_STAT_START(var) uint64_t var = list_stats_now()
+#define LIST_STAT_ADD(list, field, n) ((list)->stats->field += (n))
+#define LIST_STAT_END(list, op, var) list_stats_record((list), (op), (var))
+#else
+#define LIST_STAT_START(var) do { } while (0)
+#define LIST_STAT_ADD(list, field, n) do { } while (0)
+#define LIST_STAT_END(list, op, var) do { } while (0)
+#endif
+
+#ifdef LIST_TRACE
+/**
+ * @brief Append a record for an operation to the trace of the calling thread.
+ */
+void list_trace_record(const list_t *list, list_op_t op, size_t index, uint8_t hit, size_t traversed);
+
+#define LIST_TRACE_OP(list, op, index, hit, traversed) \
+    list_trace_record((list), (op), (index), (hit), (traversed))
+#else
+#define LIST_TRACE_OP(list, op, index, hit, traversed) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,591 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/**
+ * An entry of the hash index, free while handle.slot is 0.
+ */
+typedef struct lru_entry
+{
+    uint64_t hash;          /* Hash of the data the handle refers to */
+    list_handle_t handle;   /* The element in the recency list */
+} lru_entry_t;
+
+/* Shards and counter stripes are kept on cache lines of their own so they
+ * do not false share */
+#define LRU_LINE 64
+
+/* Hit and miss counter stripes of a cache, a thread always counts on the same one */
+#define LRU_STAT_STRIPES 8
+
+/**
+ * Hit and miss counters of the threads using one stripe.
+ */
+typedef union lru_counters
+{
+    struct
+    {
+        uint64_t hits;
+        uint64_t misses;
+    };
+    char pad[LRU_LINE];
+} lru_counters_t;
+
+/**
+ * A cache of at most capacity elements. The recency list holds the most
+ * recently used element at the front, the index maps the hash of an element
+ * to its handle with open addressing and linear probing.
+ */
+struct list_lru
+{
+    list_t *list;                     /* Elements in recency order */
+    uint64_t (*hash)(const void *);   /* Hashes an element, consistent with compare_to */
+    size_t capacity;                  /* Elements kept before the least recent is evicted */
+    lru_entry_t *index;               /* Hash index of the elements */
+    size_t mask;                      /* Index size minus one, the size is a power of two */
+    list_lru_policy_t policy;         /* Move to front on a hit or CLOCK */
+    lru_counters_t *counters;         /* LRU_STAT_STRIPES hit and miss counters, aligned to LRU_LINE */
+    void *counters_mem;               /* The allocation counters lives in */
+    uint64_t inserts;                 /* Elements put, including replacements */
+    uint64_t evictions;               /* Elements dropped because the cache was full */
+};
+
+/* Source of counter stripes for threads */
+static unsigned next_stripe = 0;
+/* Counter stripe of the calling thread plus one, 0 until it first counts */
+static _Thread_local unsigned my_stripe = 0;
+
+/**
+ * One shard of a sharded cache: a cache and the lock protecting it.
+ */
+typedef union lru_shard
+{
+    struct
+    {
+        pthread_rwlock_t lock;  /* Shared for CLOCK lookups, exclusive otherwise */
+        list_lru_t *lru;
+    };
+    char pad[LRU_LINE];
+} lru_shard_t;
+
+/**
+ * A cache split into independent shards by the hash of the key.
+ */
+struct list_lru_sharded
+{
+    lru_shard_t *shards;              /* nshards shards, aligned to LRU_LINE */
+    void *shards_mem;                 /* The allocation shards lives in */
+    size_t nshards;
+    uint64_t (*hash)(const void *);
+    list_lru_policy_t policy;         /* Policy of every shard */
+};
+
+/**
+ * Find the index entry of an element equal to key.
+ *
+ * @param lru the cache
+ * @param key the key
+ * @param hash hash of key
+ * @return the position of the entry, or of the free entry ending the probe if key is missing
+ */
+static size_t lru_find(const list_lru_t *lru, const void *key, uint64_t hash) {
+    size_t pos = hash & lru->mask;
+    for (;;) {
+        const lru_entry_t *entry = &lru->index[pos];
+        if (entry->handle.slot == 0) return pos;
+        if (entry->hash == hash &&
+            lru->list->compare_to(list_handle_get(lru->list, entry->handle), key) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & lru->mask;
+    }
+}
+
+/**
+ * Find the index entry of a node of the recency list.
+ *
+ * @param lru the cache
+ * @param node the node
+ * @return the position of its entry
+ */
+static size_t lru_find_node(const list_lru_t *lru, const node_t *node) {
+    size_t pos = lru->hash(node->data) & lru->mask;
+    while (lru->index[pos].handle.slot != LIST_NODE_SLOT(node)) {
+        pos = (pos + 1) & lru->mask;
+    }
+    return pos;
+}
+
+/**
+ * Empty an index entry and shift the entries of the probe run after it back,
+ * so lookups never stop early at a hole.
+ *
+ * @param lru the cache
+ * @param pos the entry to empty
+ */
+static void lru_erase(list_lru_t *lru, size_t pos) {
+    size_t next = (pos + 1) & lru->mask;
+    while (lru->index[next].handle.slot != 0) {
+        size_t home = lru->index[next].hash & lru->mask;
+        // Move the entry back unless its home lies in (pos, next]
+        if (((next - home) & lru->mask) >= ((next - pos) & lru->mask)) {
+            lru->index[pos] = lru->index[next];
+            pos = next;
+        }
+        next = (next + 1) & lru->mask;
+    }
+    lru->index[pos].handle.slot = 0;
+}
+
+/**
+ * Create a cache.
+ *
+ * @param capacity the most elements kept
+ * @param hash hashes an element
+ * @param destroy_data frees an element
+ * @param compare_to compares two elements
+ * @return the cache or NULL if out of memory or on invalid arguments
+ */
+list_lru_t *list_lru_init(size_t capacity, uint64_t (*hash)(const void *),
+                          void (*destroy_data)(void *), int (*compare_to)(const void *, const void *)) {
+    if (capacity == 0 || capacity > UINT32_MAX / 4 || hash == NULL || destroy_data == NULL ||
+        compare_to == NULL) {
+        fprintf(stderr, "Error: Invalid cache parameters\n");
+        return NULL;
+    }
+
+    list_lru_t *lru = list_mem_alloc(sizeof(list_lru_t));
+    if (lru == NULL) {
+        fprintf(stderr, "Error: Cache memory allocation failed\n");
+        return NULL;
+    }
+
+    // Keep the load factor at or below one half
+    size_t size = 2;
+    while (size < capacity * 2) size *= 2;
+    lru->index = list_mem_alloc(size * sizeof(lru_entry_t));
+    lru->counters_mem = list_mem_alloc(LRU_STAT_STRIPES * sizeof(lru_counters_t) + LRU_LINE - 1);
+    lru->list = list_init(destroy_data, compare_to);
+    if (lru->index == NULL || lru->counters_mem == NULL || lru->list == NULL) {
+        list_mem_free(lru->index);
+        list_mem_free(lru->counters_mem);
+        list_destroy(&lru->list);
+        list_mem_free(lru);
+        fprintf(stderr, "Error: Cache memory allocation failed\n");
+        return NULL;
+    }
+    memset(lru->index, 0, size * sizeof(lru_entry_t));
+    lru->mask = size - 1;
+    lru->hash = hash;
+    lru->capacity = capacity;
+    lru->policy = LIST_LRU_EXACT;
+    lru->counters = (lru_counters_t *)(((uintptr_t)lru->counters_mem + LRU_LINE - 1) &
+                                       ~(uintptr_t)(LRU_LINE - 1));
+    memset(lru->counters, 0, LRU_STAT_STRIPES * sizeof(lru_counters_t));
+    lru->inserts = 0;
+    lru->evictions = 0;
+    return lru;
+}
+
+/**
+ * Destroy the cache and every element in it.
+ *
+ * @param lru a pointer to the cache, set to NULL
+ */
+void list_lru_destroy(list_lru_t **lru) {
+    if (lru == NULL || *lru == NULL) return;
+    list_destroy(&(*lru)->list);
+    list_mem_free((*lru)->index);
+    list_mem_free((*lru)->counters_mem);
+    list_mem_free(*lru);
+    *lru = NULL;
+}
+
+/**
+ * Choose how the cache tracks recency.
+ *
+ * @param lru the cache
+ * @param policy the policy to use from now on
+ */
+void list_lru_set_policy(list_lru_t *lru, list_lru_policy_t policy) {
+    if (lru == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return;
+    }
+    lru->policy = policy;
+}
+
+/**
+ * Mark an element as used, by moving it to the front or setting its
+ * reference bit. The bit is only written when it is clear, so CLOCK hits
+ * on the same element from several threads do not bounce its cache line.
+ *
+ * @param lru the cache
+ * @param node the node of the element
+ */
+static void lru_touch(list_lru_t *lru, node_t *node) {
+    if (lru->policy == LIST_LRU_CLOCK) {
+        if (__atomic_load_n(&node->hits, __ATOMIC_RELAXED) == 0) {
+            __atomic_store_n(&node->hits, 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        list_node_move_to_front(lru->list, node);
+    }
+}
+
+/**
+ * Pick the element to evict: the back of the list, after giving every
+ * referenced element on the way a second chance at the front.
+ *
+ * @param lru the cache
+ * @return the node to evict
+ */
+static node_t *lru_victim(list_lru_t *lru) {
+    node_t *victim = lru->list->head->prev;
+    while (lru->policy == LIST_LRU_CLOCK && victim->hits != 0) {
+        victim->hits = 0;
+        list_node_move_to_front(lru->list, victim);
+        victim = lru->list->head->prev;
+    }
+    return victim;
+}
+
+/**
+ * Get the counter stripe of the calling thread.
+ *
+ * @param lru the cache
+ * @return the counters to count on
+ */
+static lru_counters_t *lru_counters(const list_lru_t *lru) {
+    if (my_stripe == 0) {
+        my_stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % LRU_STAT_STRIPES + 1;
+    }
+    return &lru->counters[my_stripe - 1];
+}
+
+/**
+ * Look up an element and mark it as used. With LIST_LRU_CLOCK this does not
+ * change the cache, so it may run concurrently with other lookups. Those
+ * count on the stripe of their thread, away from the lines every lookup reads.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, still owned by the cache, or NULL on a miss
+ */
+void *list_lru_get(list_lru_t *lru, const void *key) {
+    if (lru == NULL || key == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return NULL;
+    }
+
+    lru_entry_t *entry = &lru->index[lru_find(lru, key, lru->hash(key))];
+    if (entry->handle.slot == 0) {
+        __atomic_add_fetch(&lru_counters(lru)->misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_add_fetch(&lru_counters(lru)->hits, 1, __ATOMIC_RELAXED);
+    node_t *node = list_handle_node(lru->list, entry->handle);
+    lru_touch(lru, node);
+    return node->data;
+}
+
+/**
+ * Insert an element as the most recently used. An equal element is replaced,
+ * otherwise the least recently used one is evicted when the cache is full.
+ *
+ * @param lru the cache
+ * @param data the element, owned by the cache from now on
+ * @return 0 on success or -1 if out of memory
+ */
+int list_lru_put(list_lru_t *lru, void *data) {
+    if (lru == NULL || data == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return -1;
+    }
+
+    uint64_t hash = lru->hash(data);
+    lru_entry_t *entry = &lru->index[lru_find(lru, data, hash)];
+    if (entry->handle.slot != 0) {
+        void *old = list_handle_update(lru->list, entry->handle, data);
+        if (old != data) lru->list->destroy_data(old);
+        lru_touch(lru, list_handle_node(lru->list, entry->handle));
+        lru->inserts++;
+        return 0;
+    }
+
+    // Make room first, so a CLOCK sweep puts the elements it spares in front
+    // of the victim but behind the new element, which has not been used yet
+    if (lru->list->size >= lru->capacity) {
+        node_t *victim = lru_victim(lru);
+        lru_erase(lru, lru_find_node(lru, victim));
+        lru->list->destroy_data(list_remove_node(lru->list, victim));
+        lru->evictions++;
+        entry = &lru->index[lru_find(lru, data, hash)]; // The erase may have shifted entries
+    }
+
+    list_handle_t handle = list_add_handle(lru->list, data);
+    if (handle.slot == 0) return -1;
+    entry->hash = hash;
+    entry->handle = handle;
+    lru->inserts++;
+    return 0;
+}
+
+/**
+ * Take an element out of the cache.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, now owned by the caller, or NULL if not cached
+ */
+void *list_lru_remove(list_lru_t *lru, const void *key) {
+    if (lru == NULL || key == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return NULL;
+    }
+
+    size_t pos = lru_find(lru, key, lru->hash(key));
+    list_handle_t handle = lru->index[pos].handle;
+    if (handle.slot == 0) return NULL;
+    lru_erase(lru, pos);
+    return list_remove_handle(lru->list, handle);
+}
+
+/**
+ * Number of elements in the cache.
+ *
+ * @param lru the cache
+ * @return the number of elements
+ */
+size_t list_lru_size(const list_lru_t *lru) {
+    return lru ? lru->list->size : 0;
+}
+
+/**
+ * Copy the counters of the cache.
+ *
+ * @param lru the cache
+ * @param stats filled with the counters
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_lru_stats(const list_lru_t *lru, list_lru_stats_t *stats) {
+    if (lru == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return -1;
+    }
+    // Lookups under a shared lock may be counting at the same time
+    stats->hits = 0;
+    stats->misses = 0;
+    for (size_t i = 0; i < LRU_STAT_STRIPES; i++) {
+        stats->hits += __atomic_load_n(&lru->counters[i].hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&lru->counters[i].misses, __ATOMIC_RELAXED);
+    }
+    stats->inserts = lru->inserts;
+    stats->evictions = lru->evictions;
+    return 0;
+}
+
+/**
+ * Pick the shard of a key. The high bits of the hash choose the shard, the
+ * low bits are left to the index inside it.
+ *
+ * @param lru the cache
+ * @param key the key
+ * @return the shard
+ */
+static lru_shard_t *shard_of(const list_lru_sharded_t *lru, const void *key) {
+    return &lru->shards[(lru->hash(key) >> 32) % lru->nshards];
+}
+
+/**
+ * Create a sharded cache.
+ *
+ * @param nshards number of shards
+ * @param capacity the most elements kept over all shards
+ * @param hash hashes an element
+ * @param destroy_data frees an element
+ * @param compare_to compares two elements
+ * @return the cache or NULL if out of memory or on invalid arguments
+ */
+list_lru_sharded_t *list_lru_sharded_init(size_t nshards, size_t capacity, uint64_t (*hash)(const void *),
+                                          void (*destroy_data)(void *),
+                                          int (*compare_to)(const void *, const void *)) {
+    if (nshards == 0 || capacity < nshards || destroy_data == NULL) {
+        fprintf(stderr, "Error: Invalid cache parameters\n");
+        return NULL;
+    }
+
+    list_lru_sharded_t *lru = list_mem_alloc(sizeof(list_lru_sharded_t));
+    void *mem = list_mem_alloc(nshards * sizeof(lru_shard_t) + LRU_LINE - 1);
+    if (lru == NULL || mem == NULL) {
+        list_mem_free(lru);
+        list_mem_free(mem);
+        fprintf(stderr, "Error: Cache memory allocation failed\n");
+        return NULL;
+    }
+    lru->shards_mem = mem;
+    lru->shards = (lru_shard_t *)(((uintptr_t)mem + LRU_LINE - 1) & ~(uintptr_t)(LRU_LINE - 1));
+    lru->hash = hash;
+    lru->policy = LIST_LRU_EXACT;
+
+    // Spread the capacity, the first shards take the remainder
+    for (lru->nshards = 0; lru->nshards < nshards; lru->nshards++) {
+        lru_shard_t *shard = &lru->shards[lru->nshards];
+        size_t cap = capacity / nshards + (lru->nshards < capacity % nshards);
+        shard->lru = list_lru_init(cap, hash, destroy_data, compare_to);
+        if (shard->lru == NULL) {
+            list_lru_sharded_destroy(&lru);
+            return NULL;
+        }
+        pthread_rwlock_init(&shard->lock, NULL);
+    }
+    return lru;
+}
+
+/**
+ * Destroy the cache and every element in it.
+ *
+ * @param lru a pointer to the cache, set to NULL
+ */
+void list_lru_sharded_destroy(list_lru_sharded_t **lru) {
+    if (lru == NULL || *lru == NULL) return;
+    for (size_t i = 0; i < (*lru)->nshards; i++) {
+        pthread_rwlock_destroy(&(*lru)->shards[i].lock);
+        list_lru_destroy(&(*lru)->shards[i].lru);
+    }
+    list_mem_free((*lru)->shards_mem);
+    list_mem_free(*lru);
+    *lru = NULL;
+}
+
+/**
+ * Set the policy of every shard.
+ *
+ * @param lru the cache
+ * @param policy the policy to use from now on
+ */
+void list_lru_sharded_set_policy(list_lru_sharded_t *lru, list_lru_policy_t policy) {
+    if (lru == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return;
+    }
+    lru->policy = policy;
+    for (size_t i = 0; i < lru->nshards; i++) {
+        list_lru_set_policy(lru->shards[i].lru, policy);
+    }
+}
+
+/**
+ * Look up an element, mark it as used and call fn on it while the shard is
+ * locked, shared under LIST_LRU_CLOCK.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @param fn called with the element and ctx on a hit, may be NULL
+ * @param ctx passed to fn
+ * @return 1 on a hit, 0 on a miss or -1 on invalid arguments
+ */
+int list_lru_sharded_get(list_lru_sharded_t *lru, const void *key, void (*fn)(void *, void *), void *ctx) {
+    if (lru == NULL || key == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return -1;
+    }
+
+    lru_shard_t *shard = shard_of(lru, key);
+    if (lru->policy == LIST_LRU_CLOCK) {
+        pthread_rwlock_rdlock(&shard->lock);
+    } else {
+        pthread_rwlock_wrlock(&shard->lock);
+    }
+    void *data = list_lru_get(shard->lru, key);
+    if (data != NULL && fn != NULL) fn(data, ctx);
+    pthread_rwlock_unlock(&shard->lock);
+    return data != NULL;
+}
+
+/**
+ * Insert an element into its shard.
+ *
+ * @param lru the cache
+ * @param data the element, owned by the cache from now on
+ * @return 0 on success or -1 if out of memory
+ */
+int list_lru_sharded_put(list_lru_sharded_t *lru, void *data) {
+    if (lru == NULL || data == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return -1;
+    }
+
+    lru_shard_t *shard = shard_of(lru, data);
+    pthread_rwlock_wrlock(&shard->lock);
+    int rval = list_lru_put(shard->lru, data);
+    pthread_rwlock_unlock(&shard->lock);
+    return rval;
+}
+
+/**
+ * Take an element out of the cache.
+ *
+ * @param lru the cache
+ * @param key compared to the elements with compare_to
+ * @return the element, now owned by the caller, or NULL if not cached
+ */
+void *list_lru_sharded_remove(list_lru_sharded_t *lru, const void *key) {
+    if (lru == NULL || key == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return NULL;
+    }
+
+    lru_shard_t *shard = shard_of(lru, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    void *data = list_lru_remove(shard->lru, key);
+    pthread_rwlock_unlock(&shard->lock);
+    return data;
+}
+
+/**
+ * Number of elements over all shards.
+ *
+ * @param lru the cache
+ * @return the number of elements
+ */
+size_t list_lru_sharded_size(list_lru_sharded_t *lru) {
+    size_t size = 0;
+    for (size_t i = 0; lru != NULL && i < lru->nshards; i++) {
+        pthread_rwlock_rdlock(&lru->shards[i].lock);
+        size += list_lru_size(lru->shards[i].lru);
+        pthread_rwlock_unlock(&lru->shards[i].lock);
+    }
+    return size;
+}
+
+/**
+ * Sum the counters of every shard.
+ *
+ * @param lru the cache
+ * @param stats filled with the counters
+ * @return 0 on success or -1 if an argument is NULL
+ */
+int list_lru_sharded_stats(list_lru_sharded_t *lru, list_lru_stats_t *stats) {
+    if (lru == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Cache is NULL\n");
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < lru->nshards; i++) {
+        list_lru_stats_t shard = { 0 };
+        pthread_rwlock_rdlock(&lru->shards[i].lock);
+        list_lru_stats(lru->shards[i].lru, &shard);
+        pthread_rwlock_unlock(&lru->shards[i].lock);
+        stats->hits += shard.hits;
+        stats->misses += shard.misses;
+        stats->inserts += shard.inserts;
+        stats->evictions += shard.evictions;
+    }
+    return 0;
+}
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/**
+ * What one thread of a parallel search works on.
+ */
+typedef struct search_task
+{
+    list_t *list;
+    void *data;         /* What to look for */
+    size_t ntasks;      /* How many tasks the list is split into */
+    size_t best;        /* Lowest index found by any task, SIZE_MAX if none */
+    size_t comparisons; /* compare_to calls made by all tasks */
+} search_task_t;
+
+/**
+ * What the threads of a parallel destroy work on.
+ */
+typedef struct destroy_task
+{
+    list_t *list;
+    size_t ntasks; /* How many tasks the list is split into */
+} destroy_task_t;
+
+/**
+ * What the threads of a parallel map work on.
+ */
+typedef struct map_task
+{
+    list_t *list;
+    size_t ntasks;              /* How many tasks the list is split into */
+    void *(*fn)(void *, void *);
+    void *ctx;
+    node_block_t *block;        /* Nodes of the new list, in list order */
+    bool failed;                /* Some call to fn returned NULL */
+} map_task_t;
+
+/**
+ * What the threads of a parallel foreach work on.
+ */
+typedef struct foreach_task
+{
+    list_t *list;
+    size_t ntasks;              /* How many tasks the list is split into */
+    int (*fn)(void *, void *);
+    void *ctx;
+    int stop;                   /* First non zero value returned by fn */
+} foreach_task_t;
+
+/**
+ * What the threads of a parallel reduce work on.
+ */
+typedef struct reduce_task
+{
+    list_t *list;
+    size_t ntasks;              /* How many tasks the list is split into */
+    unsigned char *accs;        /* One accumulator per task */
+    size_t acc_size;
+    void (*fn)(void *, void *, void *);
+    void *ctx;
+} reduce_task_t;
+
+/* How many elements a search task scans between looks at the best index */
+#define SEARCH_CHECK_INTERVAL 256
+
+/**
+ * A prefetching walk over the nodes of one task, from one segment start up
+ * to another.
+ */
+typedef struct seg_walk
+{
+    node_t *curr;  /* The node being visited, end once the walk is done */
+    node_t *ahead; /* The node being prefetched */
+    node_t *end;   /* The first node past the task */
+    size_t lo;     /* Position of the first node */
+    size_t hi;     /* Position of end */
+} seg_walk_t;
+
+/**
+ * Start a walk over the nodes task of ntasks works on.
+ *
+ * @param walk the walk to start
+ * @param list the list, prepared by list_segs_prepare
+ * @param ntasks number of tasks
+ * @param task which task
+ */
+static inline void seg_walk_begin(seg_walk_t *walk, list_t *list, size_t ntasks, size_t task) {
+    list_segs_range(list, ntasks, task, &walk->curr, &walk->end, &walk->lo, &walk->hi);
+    walk->ahead = walk->curr;
+    for (unsigned i = 0; i < list_prefetch_distance && walk->ahead != walk->end; i++) {
+        __builtin_prefetch(walk->ahead->data);
+        walk->ahead = walk->ahead->next;
+        __builtin_prefetch(walk->ahead);
+    }
+}
+
+/**
+ * Move the walk to the next node. Reads curr->next, so when the visited
+ * node is being freed call this before freeing it.
+ *
+ * @param walk the walk to advance
+ */
+static inline void seg_walk_next(seg_walk_t *walk) {
+    walk->curr = walk->curr->next;
+    if (walk->ahead != walk->end && list_prefetch_distance != 0) {
+        __builtin_prefetch(walk->ahead->data);
+        walk->ahead = walk->ahead->next;
+        __builtin_prefetch(walk->ahead);
+    }
+}
+
+/**
+ * Scan the segments of one task, stopping as soon as a lower index than
+ * anything they could hold has been found by another task.
+ *
+ * @param arg the search
+ * @param task which task
+ */
+static void search_segment(void *arg, size_t task) {
+    search_task_t *search = arg;
+    list_t *list = search->list;
+    size_t comparisons = 0;
+    seg_walk_t walk;
+    seg_walk_begin(&walk, list, search->ntasks, task);
+
+    for (size_t i = walk.lo; i < walk.hi; i++, seg_walk_next(&walk)) {
+        if ((i - walk.lo) % SEARCH_CHECK_INTERVAL == 0 &&
+            __atomic_load_n(&search->best, __ATOMIC_RELAXED) < i) {
+            break;
+        }
+        comparisons++;
+        if (list->compare_to(walk.curr->data, search->data) == 0) {
+            // Keep the lowest index any task found
+            size_t best = __atomic_load_n(&search->best, __ATOMIC_RELAXED);
+            while (i < best && !__atomic_compare_exchange_n(&search->best, &best, i, false,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+            break;
+        }
+    }
+    __atomic_add_fetch(&search->comparisons, comparisons, __ATOMIC_RELAXED);
+}
+
+/**
+ * Search for data using several threads.
+ *
+ * @param list the list to search for data
+ * @param data the data to look for
+ * @param nthreads the most threads to use
+ * @return The index of the first match or -1 if not found
+ */
+int list_indexof_parallel(list_t *list, void *data, size_t nthreads) {
+    if (list == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: Data is NULL\n");
+        return -1;
+    }
+
+    // Small lists, lists we can not index and misses the filter catches are
+    // searched the usual way
+    size_t ntasks = list_parallel_tasks(list->size, nthreads);
+    if (ntasks <= 1 || list->compare_to == NULL || (list->hash && !list_bloom_may_contain(list, data)) ||
+        (ntasks = list_segs_prepare(list, ntasks)) <= 1) {
+        return list_indexof(list, data);
+    }
+
+    LIST_STAT_START(start);
+    search_task_t search = { list, data, ntasks, SIZE_MAX, 0 };
+    if (list_parallel_run(ntasks, search_segment, &search) != 0) {
+        return list_indexof(list, data);
+    }
+
+    bool hit = search.best != SIZE_MAX;
+    LIST_STAT_ADD(list, comparisons, search.comparisons);
+    LIST_STAT_ADD(list, nodes_traversed, search.comparisons);
+    if (hit) {
+        LIST_STAT_ADD(list, indexof_hits, 1);
+    } else {
+        LIST_STAT_ADD(list, indexof_misses, 1);
+    }
+    LIST_STAT_END(list, LIST_OP_INDEXOF, start);
+    LIST_TRACE_OP(list, LIST_OP_INDEXOF, search.best, hit, search.comparisons);
+    return hit ? (int)search.best : -1;
+}
+
+/**
+ * Destroy the data and free the nodes of the segments of one task.
+ *
+ * @param arg the list
+ * @param task which task
+ */
+static void destroy_segment(void *arg, size_t task) {
+    destroy_task_t *destroy = arg;
+    list_t *list = destroy->list;
+    seg_walk_t walk;
+    seg_walk_begin(&walk, list, destroy->ntasks, task);
+
+    while (walk.curr != walk.end) {
+        node_t *node = walk.curr;
+        list->destroy_data(node->data);
+        seg_walk_next(&walk);
+        list_node_free(node);
+    }
+}
+
+/**
+ * Destroy the list using several threads.
+ *
+ * @param list a pointer to the list that needs to be destroyed
+ * @param nthreads the most threads to use
+ */
+void list_destroy_parallel(list_t **list, size_t nthreads) {
+    if (list == NULL || *list == NULL) return;
+
+    size_t ntasks = list_segs_prepare(*list, list_parallel_tasks((*list)->size, nthreads));
+    if (ntasks <= 1) {
+        list_destroy(list);
+        return;
+    }
+
+    destroy_task_t destroy = { *list, ntasks };
+    if (list_parallel_run(ntasks, destroy_segment, &destroy) != 0) {
+        list_destroy(list);
+        return;
+    }
+    list_free_shell(*list);
+    *list = NULL;
+}
+
+/**
+ * Map the segments of one task into the matching nodes of the new list's block.
+ *
+ * @param arg the map
+ * @param task which task
+ */
+static void map_segment(void *arg, size_t task) {
+    map_task_t *map = arg;
+    seg_walk_t walk;
+    seg_walk_begin(&walk, map->list, map->ntasks, task);
+
+    for (size_t i = walk.lo; i < walk.hi; i++, seg_walk_next(&walk)) {
+        node_t *node = &map->block->nodes[i];
+        node->data = map->fn(walk.curr->data, map->ctx);
+        if (node->data == NULL) {
+            __atomic_store_n(&map->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Map the whole list on the calling thread, walking the chain.
+ *
+ * @param map the map
+ */
+static void map_chain(map_task_t *map) {
+    list_walk_t walk;
+    size_t i = 0;
+    for (list_walk_begin(&walk, map->list, true); walk.curr != map->list->head; list_walk_next(&walk)) {
+        node_t *node = &map->block->nodes[i++];
+        node->data = map->fn(walk.curr->data, map->ctx);
+        if (node->data == NULL) map->failed = true;
+    }
+}
+
+/**
+ * Create a new list holding fn of every element, using several threads.
+ *
+ * @param list the list to map
+ * @param fn returns the new data for an element, NULL on failure
+ * @param ctx passed to fn
+ * @param destroy_data destroy_data of the new list
+ * @param compare_to compare_to of the new list
+ * @param nthreads the most threads to use
+ * @return the new list or NULL on failure
+ */
+list_t *list_map_parallel(list_t *list, void *(*fn)(void *, void *), void *ctx,
+                          void (*destroy_data)(void *), int (*compare_to)(const void *, const void *),
+                          size_t nthreads) {
+    if (list == NULL || fn == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return NULL;
+    }
+
+    list_t *mapped = list_init(destroy_data, compare_to);
+    if (mapped == NULL) return NULL;
+    if (list->size == 0) return mapped;
+
+    // The new nodes all come from one block, in list order
+    map_task_t map = { list, list_parallel_tasks(list->size, nthreads), fn, ctx, NULL, false };
+    map.block = list_block_alloc(list->size);
+    if (map.block == NULL) {
+        list_destroy(&mapped);
+        return NULL;
+    }
+    map.ntasks = list_segs_prepare(list, map.ntasks);
+    if (map.ntasks <= 1 || list_parallel_run(map.ntasks, map_segment, &map) != 0) {
+        map_chain(&map);
+    }
+
+    node_block_t *block = map.block;
+    if (map.failed) {
+        for (size_t i = 0; destroy_data != NULL && i < list->size; i++) {
+            if (block->nodes[i].data != NULL) destroy_data(block->nodes[i].data);
+        }
+        list_block_free(block);
+        list_destroy(&mapped);
+        return NULL;
+    }
+
+    node_t *prev = mapped->head;
+    for (size_t i = 0; i < list->size; i++) {
+        block->nodes[i].prev = prev;
+        prev->next = &block->nodes[i];
+        prev = &block->nodes[i];
+    }
+    prev->next = mapped->head;
+    mapped->head->prev = prev;
+    mapped->size = list->size;
+    return mapped;
+}
+
+/**
+ * Create a new list holding fn of every element.
+ *
+ * @param list the list to map
+ * @param fn returns the new data for an element, NULL on failure
+ * @param ctx passed to fn
+ * @param destroy_data destroy_data of the new list
+ * @param compare_to compare_to of the new list
+ * @return the new list or NULL on failure
+ */
+list_t *list_map(list_t *list, void *(*fn)(void *, void *), void *ctx,
+                 void (*destroy_data)(void *), int (*compare_to)(const void *, const void *)) {
+    return list_map_parallel(list, fn, ctx, destroy_data, compare_to, 1);
+}
+
+/**
+ * Call fn on every element of the segments of one task.
+ *
+ * @param arg the foreach
+ * @param task which task
+ */
+static void foreach_segment(void *arg, size_t task) {
+    foreach_task_t *each = arg;
+    seg_walk_t walk;
+    seg_walk_begin(&walk, each->list, each->ntasks, task);
+
+    for (size_t i = walk.lo; i < walk.hi; i++, seg_walk_next(&walk)) {
+        if ((i - walk.lo) % SEARCH_CHECK_INTERVAL == 0 && __atomic_load_n(&each->stop, __ATOMIC_RELAXED)) {
+            break;
+        }
+        int rval = each->fn(walk.curr->data, each->ctx);
+        if (rval != 0) {
+            int none = 0;
+            __atomic_compare_exchange_n(&each->stop, &none, rval, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+/**
+ * Call fn on the data of every element using several threads.
+ *
+ * @param list the list to walk
+ * @param fn called with the data of each element and ctx, returns non zero to stop
+ * @param ctx passed to fn
+ * @param nthreads the most threads to use
+ * @return 0 when every element was visited, a non zero value fn stopped with,
+ * or -1 on failure
+ */
+int list_foreach_parallel(list_t *list, int (*fn)(void *, void *), void *ctx, size_t nthreads) {
+    if (list == NULL || fn == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    foreach_task_t each = { list, list_parallel_tasks(list->size, nthreads), fn, ctx, 0 };
+    each.ntasks = list_segs_prepare(list, each.ntasks);
+    if (each.ntasks <= 1 || list_parallel_run(each.ntasks, foreach_segment, &each) != 0) {
+        return list_foreach(list, fn, ctx);
+    }
+    return each.stop;
+}
+
+/**
+ * Fold the segments of one task into its accumulator.
+ *
+ * @param arg the reduce
+ * @param task which task
+ */
+static void reduce_segment(void *arg, size_t task) {
+    reduce_task_t *reduce = arg;
+    void *acc = reduce->accs + task * reduce->acc_size;
+    seg_walk_t walk;
+
+    for (seg_walk_begin(&walk, reduce->list, reduce->ntasks, task); walk.curr != walk.end; seg_walk_next(&walk)) {
+        reduce->fn(acc, walk.curr->data, reduce->ctx);
+    }
+}
+
+/**
+ * Fold every element into an accumulator using several threads.
+ *
+ * @param list the list to reduce
+ * @param accs nthreads accumulators of acc_size bytes, all set to the identity
+ * @param acc_size size of one accumulator
+ * @param fn folds one element into an accumulator
+ * @param combine folds the second accumulator into the first
+ * @param ctx passed to fn and combine
+ * @param nthreads the most threads to use and the number of accumulators
+ * @return 0 on success or -1 on failure
+ */
+int list_reduce_parallel(list_t *list, void *accs, size_t acc_size,
+                         void (*fn)(void *, void *, void *), void (*combine)(void *, const void *, void *),
+                         void *ctx, size_t nthreads) {
+    if (list == NULL || accs == NULL || fn == NULL || combine == NULL || nthreads == 0) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    reduce_task_t reduce = { list, list_parallel_tasks(list->size, nthreads), accs, acc_size, fn, ctx };
+    reduce.ntasks = list_segs_prepare(list, reduce.ntasks);
+    if (reduce.ntasks <= 1 || list_parallel_run(reduce.ntasks, reduce_segment, &reduce) != 0) {
+        return list_reduce(list, accs, fn, ctx);
+    }
+
+    // Segments are combined in list order so combine need not be commutative
+    for (size_t i = 1; i < reduce.ntasks; i++) {
+        combine(accs, reduce.accs + i * acc_size, ctx);
+    }
+    return 0;
+}
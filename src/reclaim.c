@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/**
+ * A unit of work handed to the reclaimer. Either a whole detached list or a
+ * single data element together with the function that destroys it.
+ */
+typedef struct reclaim_item
+{
+    struct reclaim_item *next;     /* next item in the handoff queue */
+    list_t *list;                  /* detached list to free, NULL for a data item */
+    void (*destroy_data)(void *);  /* destroys data when list is NULL */
+    void *data;                    /* data to destroy when list is NULL */
+} reclaim_item_t;
+
+/* State of the process wide reclaimer, all fields are protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t joined = PTHREAD_COND_INITIALIZER; /* Signalled when joining goes back to false */
+static pthread_t worker;
+static bool running = false;
+static bool stopping = false;
+static bool joining = false; /* A stop is waiting for the worker to exit */
+static reclaim_item_t *queue_head = NULL;
+static reclaim_item_t *queue_tail = NULL;
+
+/**
+ * Destroy a single work item and release it.
+ *
+ * @param item the item to process
+ */
+static void reclaim_run(reclaim_item_t *item) {
+    if (item->list != NULL) {
+        list_free_all(item->list);
+    } else if (item->destroy_data != NULL) {
+        item->destroy_data(item->data);
+    }
+    list_mem_free(item);
+}
+
+/**
+ * Worker loop, takes the whole queue at once so producers only hold the lock
+ * for a pointer swap. Exits once stop was requested and the queue is drained.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *reclaim_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (queue_head == NULL && !stopping) {
+            pthread_cond_wait(&wakeup, &lock);
+        }
+        if (queue_head == NULL) break; // Stopping and nothing left to do
+
+        reclaim_item_t *batch = queue_head;
+        queue_head = queue_tail = NULL;
+        pthread_mutex_unlock(&lock);
+
+        while (batch != NULL) {
+            reclaim_item_t *next = batch->next;
+            reclaim_run(batch);
+            batch = next;
+        }
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * Hand an item to the worker, or run it on the calling thread if the
+ * reclaimer is not running.
+ *
+ * @param item the item to destroy
+ */
+static void reclaim_submit(reclaim_item_t *item) {
+    item->next = NULL;
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        reclaim_run(item);
+        return;
+    }
+    if (queue_tail == NULL) {
+        queue_head = item;
+    } else {
+        queue_tail->next = item;
+    }
+    queue_tail = item;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Start the background reclaimer thread.
+ *
+ * @return 0 on success (or if already running), -1 if the thread could not be created
+ */
+int list_reclaimer_start(void) {
+    int rval = 0;
+    pthread_mutex_lock(&lock);
+    // The old worker must be gone before a new one may use worker and stopping
+    while (joining) {
+        pthread_cond_wait(&joined, &lock);
+    }
+    if (!running) {
+        stopping = false;
+        if (pthread_create(&worker, NULL, reclaim_main, NULL) != 0) {
+            fprintf(stderr, "Error: Could not start reclaimer thread\n");
+            rval = -1;
+        } else {
+            running = true;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return rval;
+}
+
+/**
+ * Stop the background reclaimer after everything queued has been destroyed.
+ */
+void list_reclaimer_stop(void) {
+    pthread_mutex_lock(&lock);
+    // A stop already under way returns only once its worker is gone, so wait for it
+    while (joining) {
+        pthread_cond_wait(&joined, &lock);
+    }
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    stopping = true;
+    running = false; // New work is destroyed inline from now on
+    joining = true;
+    pthread_t thread = worker;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&lock);
+    joining = false;
+    pthread_cond_broadcast(&joined);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Detach the list from the caller and destroy it on the reclaimer thread.
+ *
+ * @param list a pointer to the list that needs to be destroyed
+ */
+void list_destroy_async(list_t **list) {
+    if (list == NULL || *list == NULL) return;
+
+    reclaim_item_t *item = list_mem_alloc(sizeof(reclaim_item_t));
+    if (item == NULL) {
+        // No memory for the handoff, pay for the teardown here instead
+        list_destroy(list);
+        return;
+    }
+    item->list = *list;
+    item->destroy_data = NULL;
+    item->data = NULL;
+    *list = NULL;
+    reclaim_submit(item);
+}
+
+/**
+ * Destroy data that was removed from a list on the reclaimer thread.
+ *
+ * @param destroy_data Function that will free the memory for data
+ * @param data the data to destroy
+ */
+void list_reclaim(void (*destroy_data)(void *), void *data) {
+    if (destroy_data == NULL || data == NULL) return;
+
+    reclaim_item_t *item = list_mem_alloc(sizeof(reclaim_item_t));
+    if (item == NULL) {
+        destroy_data(data);
+        return;
+    }
+    item->list = NULL;
+    item->destroy_data = destroy_data;
+    item->data = data;
+    reclaim_submit(item);
+}
@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/* Pieces one rebuild task may cut its segment into, one more for the compaction cursor */
+#define SEGS_PIECES (LIST_SEGS_MAX + 1)
+
+/**
+ * What the threads of a segment index rebuild work on. Task s walks old
+ * segment s and cuts it into pieces of about stride nodes.
+ */
+typedef struct rebuild_task
+{
+    list_t *list;
+    list_segs_t old;  /* The index being rebuilt */
+    size_t stride;    /* Nodes per piece */
+    bool keep;        /* Segments that are short enough can be kept without a walk */
+    node_t **starts;  /* SEGS_PIECES piece starts per task */
+    size_t *counts;   /* SEGS_PIECES piece counts per task */
+    size_t *npieces;  /* Pieces cut by each task */
+} rebuild_task_t;
+
+/**
+ * Find the segment holding index, the counts must be right.
+ *
+ * @param segs the segment index
+ * @param index a position in the list
+ * @return the segment
+ */
+static size_t seg_of(const list_segs_t *segs, size_t index) {
+    size_t s = 0;
+    for (; s + 1 < segs->n && index >= segs->count[s]; s++) {
+        index -= segs->count[s];
+    }
+    return s;
+}
+
+/**
+ * Drop segment s, which has no nodes left.
+ *
+ * @param segs the segment index
+ * @param s the segment to drop
+ */
+static void seg_drop(list_segs_t *segs, size_t s) {
+    memmove(&segs->start[s], &segs->start[s + 1], (segs->n - s - 1) * sizeof(node_t *));
+    memmove(&segs->count[s], &segs->count[s + 1], (segs->n - s - 1) * sizeof(size_t));
+    segs->n--;
+    if (s < segs->compact_seg) segs->compact_seg--;
+}
+
+/**
+ * Update the segment index after node was linked in.
+ *
+ * @param list the list
+ * @param node the node just linked
+ * @param index the position of node or SIZE_MAX if not known
+ */
+void list_segs_linked(list_t *list, node_t *node, size_t index) {
+    list_segs_t *segs = list->segs;
+    if (segs->n == 0) {
+        segs->n = 1;
+        segs->start[0] = node;
+        segs->count[0] = 1;
+        segs->dirty = false;
+        segs->compact_seg = 1;
+        return;
+    }
+    if (node->prev == list->head) {
+        // A new first node is behind any compaction cursor
+        segs->start[0] = node;
+        segs->count[0]++;
+        if (segs->compact_seg == 0) segs->compact_seg = 1;
+        return;
+    }
+    // Anywhere else the node joins the segment of its predecessor
+    if (segs->dirty) return;
+    if (index == SIZE_MAX) {
+        segs->dirty = true;
+        return;
+    }
+    segs->count[seg_of(segs, index - 1)]++;
+}
+
+/**
+ * Update the segment index before node is unlinked.
+ *
+ * @param list the list
+ * @param node the node about to be unlinked
+ * @param index the position of node or SIZE_MAX if not known
+ */
+void list_segs_unlinking(list_t *list, node_t *node, size_t index) {
+    list_segs_t *segs = list->segs;
+    size_t s;
+    if (!segs->dirty && index != SIZE_MAX) {
+        s = seg_of(segs, index);
+        segs->count[s]--;
+        if (segs->start[s] != node) return;
+    } else {
+        // Only a segment start needs fixing, which also tells its segment
+        for (s = 0; s < segs->n && segs->start[s] != node; s++) {
+        }
+        if (s == segs->n) {
+            segs->dirty = true;
+            return;
+        }
+        segs->count[s]--;
+    }
+
+    node_t *end = s + 1 < segs->n ? segs->start[s + 1] : list->head;
+    if (node->next == end) {
+        seg_drop(segs, s);
+        return;
+    }
+    segs->start[s] = node->next;
+    if (s < segs->compact_seg && node->next == list->compact_cursor) {
+        segs->compact_seg = s; // The compaction pass has yet to move the new start
+    }
+}
+
+/**
+ * Update the segment index after nodes were spliced in.
+ *
+ * @param list the list
+ * @param first the first node spliced in
+ * @param count number of nodes spliced in
+ * @param at_front true if they went before the old first node
+ */
+void list_segs_spliced(list_t *list, node_t *first, size_t count, bool at_front) {
+    list_segs_t *segs = list->segs;
+    if (segs->n == 0) {
+        segs->n = 1;
+        segs->start[0] = first;
+        segs->count[0] = count;
+        segs->dirty = false;
+        segs->compact_seg = 1;
+    } else if (at_front) {
+        segs->start[0] = first;
+        segs->count[0] += count;
+        if (segs->compact_seg == 0) segs->compact_seg = 1;
+    } else {
+        segs->count[segs->n - 1] += count;
+    }
+}
+
+/**
+ * Cut the segment index down to the nodes left after a split.
+ *
+ * @param list the list
+ */
+void list_segs_truncate(list_t *list) {
+    list_segs_t *segs = list->segs;
+    if (segs->dirty) {
+        list_segs_free(list);
+        return;
+    }
+    size_t pos = 0;
+    size_t s = 0;
+    for (; s < segs->n && pos + segs->count[s] <= list->size; s++) {
+        pos += segs->count[s];
+    }
+    if (s < segs->n && pos < list->size) {
+        segs->count[s++] = list->size - pos;
+    }
+    segs->n = s;
+}
+
+/**
+ * Free the segment index of the list.
+ *
+ * @param list the list
+ */
+void list_segs_free(list_t *list) {
+    list_mem_free(list->segs);
+    list->segs = NULL;
+}
+
+/**
+ * Cut one old segment into pieces of about stride nodes. A segment that is
+ * short enough and whose count is right is kept whole without a walk. While
+ * a compaction pass is running a piece also starts at its cursor, so the
+ * pass can find the next start it has to move.
+ *
+ * @param arg the rebuild
+ * @param task which old segment
+ */
+static void rebuild_segment(void *arg, size_t task) {
+    rebuild_task_t *rebuild = arg;
+    list_t *list = rebuild->list;
+    node_t **starts = rebuild->starts + task * SEGS_PIECES;
+    size_t *counts = rebuild->counts + task * SEGS_PIECES;
+    if (rebuild->keep && rebuild->old.count[task] <= 2 * rebuild->stride) {
+        starts[0] = rebuild->old.start[task];
+        counts[0] = rebuild->old.count[task];
+        rebuild->npieces[task] = 1;
+        return;
+    }
+
+    node_t *end = task + 1 < rebuild->old.n ? rebuild->old.start[task + 1] : list->head;
+    size_t n = 0;
+    size_t run = 0;
+    for (node_t *curr = rebuild->old.start[task]; curr != end; curr = curr->next) {
+        if (n == 0 || (run == rebuild->stride && n < SEGS_PIECES - 1) || curr == list->compact_cursor) {
+            starts[n] = curr;
+            counts[n++] = 0;
+            run = 0;
+        }
+        counts[n - 1]++;
+        run++;
+    }
+    rebuild->npieces[task] = n;
+}
+
+/**
+ * Walk the segments of the list again, in parallel, and replace the index
+ * with the pieces they were cut into, merged down to LIST_SEGS_MAX.
+ *
+ * @param list the list, which has a segment index
+ * @return true on success, false if out of memory or the walk could not be
+ * handed out, the index is left as it was
+ */
+static bool segs_rebuild(list_t *list) {
+    list_segs_t *segs = list->segs;
+    rebuild_task_t rebuild = { list, *segs, (list->size + LIST_SEGS_MAX - 1) / LIST_SEGS_MAX,
+                               !segs->dirty && list->compact_block == NULL, NULL, NULL, NULL };
+    if (rebuild.old.n == 0) {
+        // A new index starts as one segment whose count has to be found
+        rebuild.old.n = 1;
+        rebuild.old.start[0] = list->head->next;
+        rebuild.keep = false;
+    }
+    size_t ntasks = rebuild.old.n;
+    rebuild.starts = list_mem_alloc(ntasks * SEGS_PIECES * sizeof(node_t *));
+    rebuild.counts = list_mem_alloc(ntasks * SEGS_PIECES * sizeof(size_t));
+    rebuild.npieces = list_mem_alloc(ntasks * sizeof(size_t));
+    bool done = rebuild.starts != NULL && rebuild.counts != NULL && rebuild.npieces != NULL &&
+                list_parallel_run(ntasks, rebuild_segment, &rebuild) == 0;
+    if (done) {
+        // Line the pieces of every task up
+        size_t total = 0;
+        for (size_t task = 0; task < ntasks; task++) {
+            for (size_t i = 0; i < rebuild.npieces[task]; i++, total++) {
+                rebuild.starts[total] = rebuild.starts[task * SEGS_PIECES + i];
+                rebuild.counts[total] = rebuild.counts[task * SEGS_PIECES + i];
+            }
+        }
+        // Merge the shortest neighbours, never past the compaction cursor
+        while (total > LIST_SEGS_MAX) {
+            size_t at = 0;
+            size_t best = SIZE_MAX;
+            for (size_t i = 0; i + 1 < total; i++) {
+                if (rebuild.starts[i + 1] != list->compact_cursor &&
+                    rebuild.counts[i] + rebuild.counts[i + 1] < best) {
+                    best = rebuild.counts[i] + rebuild.counts[i + 1];
+                    at = i;
+                }
+            }
+            rebuild.counts[at] = best;
+            total--;
+            memmove(&rebuild.starts[at + 1], &rebuild.starts[at + 2], (total - at - 1) * sizeof(node_t *));
+            memmove(&rebuild.counts[at + 1], &rebuild.counts[at + 2], (total - at - 1) * sizeof(size_t));
+        }
+        segs->n = total;
+        segs->dirty = false;
+        memcpy(segs->start, rebuild.starts, total * sizeof(node_t *));
+        memcpy(segs->count, rebuild.counts, total * sizeof(size_t));
+        for (segs->compact_seg = 0; segs->compact_seg < total; segs->compact_seg++) {
+            if (segs->start[segs->compact_seg] == list->compact_cursor) break;
+        }
+    }
+    list_mem_free(rebuild.starts);
+    list_mem_free(rebuild.counts);
+    list_mem_free(rebuild.npieces);
+    return done;
+}
+
+/**
+ * Get the segment index of the list ready for a parallel operation.
+ *
+ * @param list the list
+ * @param ntasks the tasks the operation wants
+ * @return the tasks to split the list into, 1 to run inline
+ */
+size_t list_segs_prepare(list_t *list, size_t ntasks) {
+    if (ntasks <= 1 || list->size == 0) return 1;
+    if (list->segs == NULL) {
+        list->segs = list_mem_alloc(sizeof(list_segs_t));
+        if (list->segs == NULL) return 1;
+        list->segs->n = 0;
+        list->segs->compact_seg = 0;
+        list->segs->dirty = true;
+    }
+
+    // Segments much longer than a rebuild would make them, or too few of
+    // them, leave threads idle
+    list_segs_t *segs = list->segs;
+    size_t stride = (list->size + LIST_SEGS_MAX - 1) / LIST_SEGS_MAX;
+    bool balanced = !segs->dirty && (segs->n >= LIST_SEGS_MAX / 2 || segs->n >= list->size);
+    for (size_t s = 0; balanced && s < segs->n; s++) {
+        balanced = segs->count[s] <= 2 * stride;
+    }
+    if (!balanced && !segs_rebuild(list)) {
+        // A half built index is no use
+        if (segs->dirty) list_segs_free(list);
+        return 1;
+    }
+    return ntasks < list->segs->n ? ntasks : list->segs->n;
+}
+
+/**
+ * Find the nodes task of ntasks works on.
+ *
+ * @param list the prepared list
+ * @param ntasks number of tasks
+ * @param task which task
+ * @param first set to the first node of the task
+ * @param end set to the node after the last one of the task
+ * @param lo set to the position of *first
+ * @param hi set to the position of *end
+ */
+void list_segs_range(const list_t *list, size_t ntasks, size_t task,
+                     node_t **first, node_t **end, size_t *lo, size_t *hi) {
+    // Each task takes the segments starting in its share of the positions
+    const list_segs_t *segs = list->segs;
+    size_t from = list->size * task / ntasks;
+    size_t to = list->size * (task + 1) / ntasks;
+    size_t pos = 0;
+    size_t s = 0;
+    for (; s < segs->n && pos < from; s++) {
+        pos += segs->count[s];
+    }
+    *first = s < segs->n ? segs->start[s] : list->head;
+    *lo = pos;
+    for (; s < segs->n && pos < to; s++) {
+        pos += segs->count[s];
+    }
+    *end = s < segs->n ? segs->start[s] : list->head;
+    *hi = pos;
+}
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/* First bytes of a snapshot file ("LSNP" little endian) */
+#define SNAPSHOT_MAGIC 0x504e534cu
+/* Version of the snapshot layout */
+#define SNAPSHOT_VERSION 2
+/* Records start on this alignment so they can be read in place */
+#define RECORD_ALIGN 8
+
+/**
+ * Header at the start of a snapshot. It is followed by count records padded
+ * to RECORD_ALIGN. Records are linked by their offset from the start of the
+ * file instead of by pointer so a mapped snapshot can be walked in place,
+ * offset 0 (the header) plays the part of the sentinel.
+ */
+typedef struct snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;         /* Number of records */
+    uint64_t payload_bytes; /* Bytes of records after the header */
+    uint64_t checksum;      /* FNV-1a of the record bytes */
+    uint64_t first;         /* Offset of the front record, 0 if empty */
+    uint64_t last;          /* Offset of the back record, 0 if empty */
+} snapshot_header_t;
+
+/**
+ * A record, the encoded data of one element follows it.
+ */
+typedef struct snapshot_record
+{
+    uint64_t next;     /* Offset of the next record, 0 after the back */
+    uint64_t prev;     /* Offset of the previous record, 0 before the front */
+    uint32_t len;      /* Bytes of encoded data */
+    uint32_t reserved;
+} snapshot_record_t;
+
+/**
+ * A read only list backed by a mapped snapshot.
+ */
+struct list_view
+{
+    const unsigned char *base; /* Start of the mapping */
+    size_t length;             /* Bytes mapped */
+    const snapshot_header_t *header;
+    int (*compare_to)(const void *, size_t, const void *);
+};
+
+/**
+ * Continue an FNV-1a hash over len bytes.
+ *
+ * @param hash the hash so far
+ * @param buf the bytes to add
+ * @param len number of bytes
+ * @return the updated hash
+ */
+static uint64_t fnv1a(uint64_t hash, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+
+/**
+ * Size of a record holding len bytes of data, padding included.
+ *
+ * @param len bytes of encoded data
+ * @return the record size
+ */
+static size_t record_size(size_t len) {
+    return (sizeof(snapshot_record_t) + len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/**
+ * Find the record at offset in a snapshot of length bytes, checking that the
+ * record and its data lie inside the snapshot.
+ *
+ * @param base start of the snapshot
+ * @param length size of the snapshot
+ * @param offset offset of the record
+ * @return the record or NULL if the offset is bad
+ */
+static const snapshot_record_t *record_at(const unsigned char *base, size_t length, uint64_t offset) {
+    if (offset < sizeof(snapshot_header_t) || offset % RECORD_ALIGN != 0 ||
+        offset > length || length - offset < sizeof(snapshot_record_t)) {
+        return NULL;
+    }
+    const snapshot_record_t *rec = (const snapshot_record_t *)(base + offset);
+    if (rec->len > length - offset - sizeof(snapshot_record_t)) return NULL;
+    return rec;
+}
+
+/**
+ * Write the list to path as a binary snapshot.
+ *
+ * @param list the list to save
+ * @param path the file to create
+ * @param codec how to encode the elements
+ * @return 0 on success or -1 on failure
+ */
+int list_save(const list_t *list, const char *path, const list_codec_t *codec) {
+    if (list == NULL || path == NULL || codec == NULL || codec->encode == NULL) {
+        fprintf(stderr, "Error: List is NULL\n");
+        return -1;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    // The header is written again once the checksum is known
+    snapshot_header_t header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, list->size, 0, FNV_OFFSET, 0, 0 };
+    int rval = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+
+    // One scratch buffer is reused for every record and grown when needed
+    size_t cap = 256;
+    unsigned char *buf = list_mem_alloc(cap);
+    if (buf == NULL) rval = -1;
+
+    uint64_t offset = sizeof(header);
+    uint64_t prev = 0;
+    list_walk_t walk;
+    for (list_walk_begin(&walk, (list_t *)list, false); rval == 0 && walk.curr != list->head; list_walk_next(&walk)) {
+        node_t *curr = walk.curr;
+        size_t room = cap - sizeof(snapshot_record_t);
+        size_t len = codec->encode(curr->data, buf + sizeof(snapshot_record_t), room);
+        if (len > UINT32_MAX) {
+            rval = -1;
+            break;
+        }
+        size_t size = record_size(len);
+        if (size > cap) {
+            unsigned char *bigger = list_mem_alloc(size);
+            if (bigger == NULL) {
+                rval = -1;
+                break;
+            }
+            list_mem_free(buf);
+            buf = bigger;
+            cap = size;
+            codec->encode(curr->data, buf + sizeof(snapshot_record_t), cap - sizeof(snapshot_record_t));
+        }
+
+        // Records are written in list order so the links point at the neighbours
+        snapshot_record_t rec = { curr->next == list->head ? 0 : offset + size, prev, (uint32_t)len, 0 };
+        memcpy(buf, &rec, sizeof(rec));
+        memset(buf + sizeof(rec) + len, 0, size - sizeof(rec) - len);
+
+        header.checksum = fnv1a(header.checksum, buf, size);
+        header.payload_bytes += size;
+        if (fwrite(buf, 1, size, out) != size) rval = -1;
+        prev = offset;
+        offset += size;
+    }
+    if (list->size > 0) {
+        header.first = sizeof(header);
+        header.last = prev;
+    }
+    list_mem_free(buf);
+
+    if (rval == 0) {
+        if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1) {
+            rval = -1;
+        }
+    }
+    if (fclose(out) != 0) rval = -1;
+    if (rval != 0) {
+        fprintf(stderr, "Error: Could not write snapshot %s\n", path);
+        remove(path);
+    }
+    return rval;
+}
+
+/**
+ * Create a list from a snapshot written by list_save.
+ *
+ * @param path the snapshot to read
+ * @param codec how to decode the elements
+ * @param destroy_data Function that will free the memory for user supplied data
+ * @param compare_to Function that will compare two user data elements
+ * @return the new list or NULL if the file is missing, corrupt or out of memory
+ */
+list_t *list_load(const char *path, const list_codec_t *codec, void (*destroy_data)(void *),
+                  int (*compare_to)(const void *, const void *)) {
+    if (path == NULL || codec == NULL || codec->decode == NULL) return NULL;
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    snapshot_header_t header;
+    unsigned char *base = NULL;
+    list_t *list = NULL;
+    node_block_t *block = NULL;
+    size_t decoded = 0;
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != SNAPSHOT_MAGIC ||
+        header.version != SNAPSHOT_VERSION || header.payload_bytes > SIZE_MAX - sizeof(header) ||
+        header.count > header.payload_bytes / sizeof(snapshot_record_t)) {
+        goto corrupt;
+    }
+
+    // Read every record with one call, then check it before decoding anything
+    // Keep the header in front of the records so file offsets work unchanged
+    size_t length = sizeof(header) + header.payload_bytes;
+    base = list_mem_alloc(length);
+    if (base == NULL) goto fail;
+    memcpy(base, &header, sizeof(header));
+    if (fread(base + sizeof(header), 1, header.payload_bytes, in) != header.payload_bytes ||
+        fgetc(in) != EOF ||
+        fnv1a(FNV_OFFSET, base + sizeof(header), header.payload_bytes) != header.checksum) {
+        goto corrupt;
+    }
+
+    list = list_init(destroy_data, compare_to);
+    if (list == NULL) goto fail;
+    if (header.count > 0) {
+        block = list_block_alloc(header.count);
+        if (block == NULL) goto fail;
+    }
+
+    // Follow the offset links from the front record
+    uint64_t offset = header.first;
+    node_t *tail = list->head;
+    for (; decoded < header.count; decoded++) {
+        const snapshot_record_t *rec = record_at(base, length, offset);
+        if (rec == NULL) goto corrupt;
+
+        node_t *node = &block->nodes[decoded];
+        node->data = codec->decode(rec + 1, rec->len);
+        if (node->data == NULL) goto corrupt;
+        node->prev = tail;
+        tail->next = node;
+        tail = node;
+        offset = rec->next;
+    }
+    if (offset != 0) goto corrupt;
+    tail->next = list->head;
+    list->head->prev = tail;
+    list->size = decoded;
+
+    list_mem_free(base);
+    fclose(in);
+    return list;
+
+corrupt:
+    fprintf(stderr, "Error: Snapshot %s is corrupt\n", path);
+fail:
+    // Undo a partial load, the nodes not handed out yet are released with the block
+    if (list != NULL) {
+        for (size_t i = 0; list->destroy_data != NULL && i < decoded; i++) {
+            list->destroy_data(block->nodes[i].data);
+        }
+        list->size = 0;
+        list->head->next = list->head->prev = list->head;
+        list_destroy(&list);
+    }
+    if (block != NULL) list_block_free(block);
+    list_mem_free(base);
+    fclose(in);
+    return NULL;
+}
+
+/**
+ * Map a snapshot written by list_save as a read only list.
+ *
+ * @param path the snapshot to map
+ * @param compare_to compares the encoded data of a record with a search key
+ * @return the view or NULL if the file is missing or not a snapshot
+ */
+list_view_t *list_view_open(const char *path, int (*compare_to)(const void *, size_t, const void *)) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        fprintf(stderr, "Error: Snapshot %s is corrupt\n", path);
+        return NULL;
+    }
+
+    // Only the header is checked here, records are checked as they are reached
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    const snapshot_header_t *header = base;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->payload_bytes != (uint64_t)st.st_size - sizeof(snapshot_header_t)) {
+        munmap(base, (size_t)st.st_size);
+        fprintf(stderr, "Error: Snapshot %s is corrupt\n", path);
+        return NULL;
+    }
+
+    list_view_t *view = list_mem_alloc(sizeof(list_view_t));
+    if (view == NULL) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    view->base = base;
+    view->length = (size_t)st.st_size;
+    view->header = header;
+    view->compare_to = compare_to;
+    return view;
+}
+
+/**
+ * Unmap the snapshot and free the view.
+ *
+ * @param view a pointer to the view, set to NULL
+ */
+void list_view_close(list_view_t **view) {
+    if (view == NULL || *view == NULL) return;
+    munmap((void *)(*view)->base, (*view)->length);
+    list_mem_free(*view);
+    *view = NULL;
+}
+
+/**
+ * Number of elements in the view.
+ *
+ * @param view the view
+ * @return the number of elements
+ */
+size_t list_view_size(const list_view_t *view) {
+    return view == NULL ? 0 : view->header->count;
+}
+
+/**
+ * Check the checksum of the whole snapshot.
+ *
+ * @param view the view
+ * @return 0 if the snapshot is intact, -1 if not
+ */
+int list_view_verify(const list_view_t *view) {
+    if (view == NULL) return -1;
+    uint64_t sum = fnv1a(FNV_OFFSET, view->base + sizeof(snapshot_header_t), view->header->payload_bytes);
+    return sum == view->header->checksum ? 0 : -1;
+}
+
+/**
+ * Call fn on every element of the view from front to back.
+ *
+ * @param view the view
+ * @param fn called with the encoded data of each element, returns non zero to stop
+ * @param ctx passed to fn
+ * @return 0 when every element was visited, the non zero value fn stopped
+ * with, or -1 if a corrupt record was reached
+ */
+int list_view_foreach(const list_view_t *view, int (*fn)(const void *, size_t, void *), void *ctx) {
+    if (view == NULL || fn == NULL) return -1;
+    uint64_t offset = view->header->first;
+    for (uint64_t i = 0; i < view->header->count; i++) {
+        const snapshot_record_t *rec = record_at(view->base, view->length, offset);
+        if (rec == NULL) return -1;
+        int rval = fn(rec + 1, rec->len, ctx);
+        if (rval != 0) return rval;
+        offset = rec->next;
+    }
+    return 0;
+}
+
+/**
+ * Search the view for an element matching key.
+ *
+ * @param view the view to search
+ * @param key the key to look for, passed to compare_to
+ * @return the index of the first match or -1 if not found
+ */
+int list_view_indexof(const list_view_t *view, const void *key) {
+    if (view == NULL || view->compare_to == NULL || key == NULL) return -1;
+    uint64_t offset = view->header->first;
+    for (uint64_t i = 0; i < view->header->count; i++) {
+        const snapshot_record_t *rec = record_at(view->base, view->length, offset);
+        if (rec == NULL) return -1;
+        if (view->compare_to(rec + 1, rec->len, key) == 0) return (int)i;
+        offset = rec->next;
+    }
+    return -1;
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lab.h"
+#include "lab_internal.h"
+
+/* Names used for the operations in the dumps, indexed by list_op_t */
+static const char *op_names[LIST_OP_COUNT] = { "add", "remove", "indexof", "unlink" };
+
+#ifdef LIST_STATS
+/**
+ * Current time in nanoseconds from a monotonic clock.
+ *
+ * @return the time in nanoseconds
+ */
+uint64_t list_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Record the latency of an operation in its log2 bucket.
+ *
+ * @param list the list the operation ran on
+ * @param op the operation
+ * @param start the value of list_stats_now when the operation started
+ */
+void list_stats_record(list_t *list, list_op_t op, uint64_t start) {
+    uint64_t elapsed = list_stats_now() - start;
+    int bucket = 63 - __builtin_clzll(elapsed | 1);
+    if (bucket >= LIST_LATENCY_BUCKETS) {
+        bucket = LIST_LATENCY_BUCKETS - 1;
+    }
+    list->stats->latency[op][bucket]++;
+}
+#endif
+
+/**
+ * Copy the operation stats of the list.
+ *
+ * @param list the list to read the stats from
+ * @param stats filled in with a copy of the stats
+ * @return 0 on success or -1 if stats are not compiled in or an argument is NULL
+ */
+int list_stats(const list_t *list, list_stats_t *stats) {
+    if (list == NULL || stats == NULL || list->stats == NULL) {
+        return -1;
+    }
+    *stats = *list->stats;
+    return 0;
+}
+
+/**
+ * Clear all the operation stats of the list.
+ *
+ * @param list the list to reset
+ */
+void list_stats_reset(list_t *list) {
+    if (list == NULL || list->stats == NULL) return;
+    memset(list->stats, 0, sizeof(list_stats_t));
+}
+
+/**
+ * Write the non empty latency buckets of one operation.
+ *
+ * @param stats the stats to dump
+ * @param op the operation
+ * @param out the stream to write to
+ * @param json true to write a JSON array, false for text
+ */
+static void dump_histogram(const list_stats_t *stats, list_op_t op, FILE *out, bool json) {
+    bool first = true;
+    for (int i = 0; i < LIST_LATENCY_BUCKETS; i++) {
+        uint64_t count = stats->latency[op][i];
+        if (count == 0) continue;
+        if (json) {
+            fprintf(out, "%s{\"ns\":%llu,\"count\":%llu}", first ? "" : ",",
+                    1ull << i, (unsigned long long)count);
+        } else {
+            fprintf(out, "  %-8s >= %12llu ns: %llu\n", op_names[op],
+                    1ull << i, (unsigned long long)count);
+        }
+        first = false;
+    }
+}
+
+/**
+ * Write the operation stats of the list as text or JSON.
+ *
+ * @param list the list to dump
+ * @param out the stream to write to
+ * @param json true to write JSON, false for text
+ * @return 0 on success or -1 if stats are not compiled in or an argument is NULL
+ */
+int list_stats_dump(const list_t *list, FILE *out, bool json) {
+    if (list == NULL || out == NULL || list->stats == NULL) {
+        return -1;
+    }
+
+    const list_stats_t *stats = list->stats;
+    if (json) {
+        fprintf(out, "{\"adds\":%llu,\"removes\":%llu,\"indexof_hits\":%llu,"
+                "\"indexof_misses\":%llu,\"nodes_traversed\":%llu,\"comparisons\":%llu,"
+                "\"filter_rejects\":%llu,\"latency\":{",
+                (unsigned long long)stats->adds, (unsigned long long)stats->removes,
+                (unsigned long long)stats->indexof_hits, (unsigned long long)stats->indexof_misses,
+                (unsigned long long)stats->nodes_traversed, (unsigned long long)stats->comparisons,
+                (unsigned long long)stats->filter_rejects);
+        for (int op = 0; op < LIST_OP_COUNT; op++) {
+            fprintf(out, "%s\"%s\":[", op == 0 ? "" : ",", op_names[op]);
+            dump_histogram(stats, op, out, true);
+            fprintf(out, "]");
+        }
+        fprintf(out, "}}\n");
+    } else {
+        fprintf(out, "adds:            %llu\n", (unsigned long long)stats->adds);
+        fprintf(out, "removes:         %llu\n", (unsigned long long)stats->removes);
+        fprintf(out, "indexof hits:    %llu\n", (unsigned long long)stats->indexof_hits);
+        fprintf(out, "indexof misses:  %llu\n", (unsigned long long)stats->indexof_misses);
+        fprintf(out, "nodes traversed: %llu\n", (unsigned long long)stats->nodes_traversed);
+        fprintf(out, "comparisons:     %llu\n", (unsigned long long)stats->comparisons);
+        fprintf(out, "filter rejects:  %llu\n", (unsigned long long)stats->filter_rejects);
+        fprintf(out, "latency:\n");
+        for (int op = 0; op < LIST_OP_COUNT; op++) {
+            dump_histogram(stats, op, out, false);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "lab.h"
+#include "lab_internal.h"
+
+#ifdef LIST_TRACE
+
+/* Records buffered per thread before they are written out */
+#define RING_SIZE 4096
+
+/**
+ * Per thread single producer ring. The owning thread is the only one that
+ * writes records and moves head, so recording never takes a lock. Draining
+ * moves tail and is serialized by the file lock, it can happen on the owning
+ * thread when the ring fills up or on whichever thread flushes or closes.
+ */
+typedef struct trace_ring
+{
+    struct trace_ring *next;                /* registry of all rings, protected by file_lock */
+    uint64_t head;                          /* next slot to fill, written by the owner only */
+    uint64_t tail;                          /* next slot to drain, written under file_lock */
+    list_trace_record_t records[RING_SIZE];
+} trace_ring_t;
+
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static trace_ring_t *rings = NULL;
+static bool enabled = false;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local trace_ring_t *my_ring = NULL;
+
+/**
+ * Timestamp for a record, the TSC where available.
+ *
+ * @return the timestamp
+ */
+static uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Write everything buffered in ring to the trace file. Caller holds file_lock.
+ *
+ * @param ring the ring to drain
+ */
+static void ring_drain(trace_ring_t *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    while (tail != head) {
+        // Write up to the end of the array, then wrap around
+        size_t start = tail % RING_SIZE;
+        size_t count = head - tail;
+        if (count > RING_SIZE - start) {
+            count = RING_SIZE - start;
+        }
+        if (trace_file != NULL) {
+            fwrite(&ring->records[start], sizeof(list_trace_record_t), count, trace_file);
+        }
+        tail += count;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Remove ring from the registry after draining it. Caller holds file_lock.
+ *
+ * @param ring the ring to release
+ */
+static void ring_release(trace_ring_t *ring) {
+    ring_drain(ring);
+    for (trace_ring_t **pp = &rings; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == ring) {
+            *pp = ring->next;
+            break;
+        }
+    }
+    list_mem_free(ring);
+}
+
+/**
+ * Thread exit hook, flushes and releases the ring of the exiting thread.
+ *
+ * @param arg the ring of the thread
+ */
+static void ring_exit(void *arg) {
+    pthread_mutex_lock(&file_lock);
+    ring_release(arg);
+    pthread_mutex_unlock(&file_lock);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_exit);
+}
+
+/**
+ * Ring of the calling thread, created on first use.
+ *
+ * @return the ring or NULL if out of memory
+ */
+static trace_ring_t *ring_get(void) {
+    if (my_ring != NULL) return my_ring;
+
+    trace_ring_t *ring = list_mem_alloc(sizeof(trace_ring_t));
+    if (ring == NULL) return NULL;
+    ring->head = ring->tail = 0;
+
+    pthread_once(&ring_key_once, ring_key_create);
+    pthread_setspecific(ring_key, ring);
+    pthread_mutex_lock(&file_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&file_lock);
+    my_ring = ring;
+    return ring;
+}
+
+/**
+ * Append a record for an operation to the ring of the calling thread.
+ *
+ * @param list the list the operation ran on
+ * @param op the operation
+ * @param index the index added at, removed or found
+ * @param hit 0 if list_indexof did not find the data, 1 if it did or
+ * LIST_TRACE_FILTERED if the filter ruled it out
+ * @param traversed nodes visited by the operation
+ */
+void list_trace_record(const list_t *list, list_op_t op, size_t index, uint8_t hit, size_t traversed) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return;
+
+    trace_ring_t *ring = ring_get();
+    if (ring == NULL) return;
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+        // Full, make room by writing our own records out
+        pthread_mutex_lock(&file_lock);
+        ring_drain(ring);
+        pthread_mutex_unlock(&file_lock);
+    }
+
+    list_trace_record_t *rec = &ring->records[head % RING_SIZE];
+    rec->tsc = trace_clock();
+    rec->index = hit == 1 ? index : UINT64_MAX;
+    rec->traversed = traversed;
+    rec->list_id = list->id;
+    rec->op = (uint8_t)op;
+    rec->hit = hit;
+    rec->reserved = 0;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Start writing a trace of all list operations to path.
+ *
+ * @param path the file to create
+ * @return 0 on success or -1 on failure
+ */
+int list_trace_open(const char *path) {
+    if (path == NULL) return -1;
+
+    pthread_mutex_lock(&file_lock);
+    if (trace_file != NULL) {
+        pthread_mutex_unlock(&file_lock);
+        fprintf(stderr, "Error: Trace already open\n");
+        return -1;
+    }
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL) {
+        pthread_mutex_unlock(&file_lock);
+        perror(path);
+        return -1;
+    }
+
+    // Drop anything left from an earlier trace
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        ring->tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    list_trace_header_t header = {
+        .magic = LIST_TRACE_MAGIC,
+        .version = LIST_TRACE_VERSION,
+        .record_size = sizeof(list_trace_record_t),
+#if defined(__x86_64__) || defined(__i386__)
+        .clock = LIST_TRACE_CLOCK_TSC,
+#else
+        .clock = LIST_TRACE_CLOCK_NS,
+#endif
+    };
+    fwrite(&header, sizeof(header), 1, trace_file);
+    __atomic_store_n(&enabled, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&file_lock);
+    return 0;
+}
+
+/**
+ * Write out the records buffered by every thread.
+ *
+ * @return 0 on success or -1 if no trace is open
+ */
+int list_trace_flush(void) {
+    pthread_mutex_lock(&file_lock);
+    if (trace_file == NULL) {
+        pthread_mutex_unlock(&file_lock);
+        return -1;
+    }
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        ring_drain(ring);
+    }
+    fflush(trace_file);
+    pthread_mutex_unlock(&file_lock);
+    return 0;
+}
+
+/**
+ * Stop tracing, write out everything buffered and close the file.
+ */
+void list_trace_close(void) {
+    __atomic_store_n(&enabled, false, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&file_lock);
+    for (trace_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+        ring_drain(ring);
+    }
+    // The calling thread will not record again until the next open
+    if (my_ring != NULL) {
+        pthread_setspecific(ring_key, NULL);
+        ring_release(my_ring);
+        my_ring = NULL;
+    }
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    pthread_mutex_unlock(&file_lock);
+}
+
+#else
+
+int list_trace_open(const char *path) {
+    (void)path;
+    return -1;
+}
+
+int list_trace_flush(void) {
+    return -1;
+}
+
+void list_trace_close(void) {
+}
+
+#endif
+
+/**
+ * Merge two runs of records that are each in timestamp order, taking from
+ * the first run on ties.
+ *
+ * @param out receives both runs merged
+ * @param a the first run
+ * @param na records in a
+ * @param b the second run
+ * @param nb records in b
+ */
+static void trace_merge(list_trace_record_t *out, const list_trace_record_t *a, size_t na,
+                        const list_trace_record_t *b, size_t nb) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb) {
+        *out++ = b[j].tsc < a[i].tsc ? b[j++] : a[i++];
+    }
+    memcpy(out, a + i, (na - i) * sizeof(*out));
+    memcpy(out + (na - i), b + j, (nb - j) * sizeof(*out));
+}
+
+/**
+ * Read a trace file and merge the records of all threads by timestamp.
+ *
+ * @param in the stream, at the start of the trace
+ * @param header filled with the header of the trace
+ * @param count filled with the number of records
+ * @return the records or NULL if the stream is not a trace or out of memory
+ */
+list_trace_record_t *list_trace_read(FILE *in, list_trace_header_t *header, size_t *count) {
+    if (in == NULL || header == NULL || count == NULL) return NULL;
+    if (fread(header, sizeof(*header), 1, in) != 1 || header->magic != LIST_TRACE_MAGIC ||
+        header->version == 0 || header->version > LIST_TRACE_VERSION ||
+        header->record_size != sizeof(list_trace_record_t)) {
+        fprintf(stderr, "Error: Not a list trace\n");
+        return NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = 1024;
+    list_trace_record_t *recs = list_mem_alloc(cap * sizeof(*recs));
+    while (recs != NULL) {
+        len += fread(recs + len, sizeof(*recs), cap - len, in);
+        if (len < cap) break;
+        list_trace_record_t *grown = list_mem_alloc(2 * cap * sizeof(*recs));
+        if (grown != NULL) memcpy(grown, recs, len * sizeof(*recs));
+        list_mem_free(recs);
+        recs = grown;
+        cap *= 2;
+    }
+    list_trace_record_t *tmp = list_mem_alloc((len ? len : 1) * sizeof(*recs));
+    if (recs == NULL || tmp == NULL) {
+        list_mem_free(recs);
+        list_mem_free(tmp);
+        fprintf(stderr, "Error: Trace memory allocation failed\n");
+        return NULL;
+    }
+
+    // Every ring is written out in order, a bottom up merge sort puts the
+    // rings back together and keeps records with equal timestamps in file order
+    for (size_t width = 1; width < len; width *= 2) {
+        for (size_t lo = 0; lo < len; lo += 2 * width) {
+            size_t mid = lo + width < len ? lo + width : len;
+            size_t hi = mid + width < len ? mid + width : len;
+            trace_merge(tmp + lo, recs + lo, mid - lo, recs + mid, hi - mid);
+        }
+        list_trace_record_t *swap = recs;
+        recs = tmp;
+        tmp = swap;
+    }
+    list_mem_free(tmp);
+    *count = len;
+    return recs;
+}
+
+/**
+ * Release records returned by list_trace_read.
+ *
+ * @param records the records
+ */
+void list_trace_free(list_trace_record_t *records) {
+    list_mem_free(records);
+}
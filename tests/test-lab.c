@@ -1,3 +1,7 @@
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
 
@@ -22,6 +26,17 @@ static void destroy_data(void *data)
   free(data);
 }
 
+static int destroyed_ = 0; // How many elements counting_destroy has freed
+
+/**
+ * Helper function, frees the memory of the data and counts the call.
+ */
+static void counting_destroy(void *data)
+{
+  __atomic_fetch_add(&destroyed_, 1, __ATOMIC_RELAXED);
+  free(data);
+}
+
 /**
  * Helper function, compares two integers.
  */
@@ -32,6 +47,93 @@ static int compare_to(const void *a, const void *b)
   return fst - snd;
 }
 
+/**
+ * Helper function, reports the payload size of an integer.
+ */
+static size_t data_size(const void *data)
+{
+  (void)data;
+  return sizeof(int);
+}
+
+/**
+ * Helper function, encodes an integer for snapshots.
+ */
+static size_t encode_int(const void *data, void *buf, size_t cap)
+{
+  if (cap >= sizeof(int))
+    {
+      memcpy(buf, data, sizeof(int));
+    }
+  return sizeof(int);
+}
+
+/**
+ * Helper function, decodes an integer from a snapshot.
+ */
+static void *decode_int(const void *buf, size_t len)
+{
+  if (len != sizeof(int))
+    {
+      return NULL;
+    }
+  int *rval = (int *)malloc(sizeof(int));
+  memcpy(rval, buf, sizeof(int));
+  return rval;
+}
+
+static const list_codec_t int_codec_ = { encode_int, decode_int };
+
+/* Elements decode_static hands out, the list does not own them */
+static int static_ints_[8];
+
+/**
+ * Helper function, decodes an integer into static_ints_, failing on 2.
+ */
+static void *decode_static(const void *buf, size_t len)
+{
+  int val;
+  if (len != sizeof(int))
+    {
+      return NULL;
+    }
+  memcpy(&val, buf, sizeof(int));
+  if (val < 0 || val >= 8 || val == 2)
+    {
+      return NULL;
+    }
+  static_ints_[val] = val;
+  return &static_ints_[val];
+}
+
+static const list_codec_t static_codec_ = { encode_int, decode_static };
+
+/**
+ * Helper function, compares an encoded integer with an integer key.
+ */
+static int compare_encoded(const void *buf, size_t len, const void *key)
+{
+  int val;
+  if (len != sizeof(int))
+    {
+      return -1;
+    }
+  memcpy(&val, buf, sizeof(int));
+  return val - *(const int *)key;
+}
+
+/**
+ * Helper function, sums encoded integers.
+ */
+static int sum_encoded(const void *buf, size_t len, void *ctx)
+{
+  int val;
+  TEST_ASSERT_EQUAL_size_t(sizeof(int), len);
+  memcpy(&val, buf, sizeof(int));
+  *(int *)ctx += val;
+  return 0;
+}
+
 /**
  * Helper function, populates the list with 5 elements.
  */
@@ -43,6 +145,24 @@ static void populate_list(void)
     }
 }
 
+static int alloc_budget_ = -1; // Allocations left before failing, -1 never fails
+
+/**
+ * Helper function, allocator that fails once alloc_budget_ runs out.
+ */
+static void *failing_alloc(size_t size)
+{
+  if (alloc_budget_ == 0)
+    {
+      return NULL;
+    }
+  if (alloc_budget_ > 0)
+    {
+      alloc_budget_--;
+    }
+  return malloc(size);
+}
+
 /** function needed by UNITY, runs before each test */
 void setUp(void) {
   lst_ = list_init(destroy_data, compare_to);
@@ -51,6 +171,8 @@ void setUp(void) {
 /** function needed by UNITY, runs after each test */
 void tearDown(void) {
   list_destroy(&lst_);
+  list_set_allocator(NULL, NULL);
+  alloc_budget_ = -1;
 }
 
 // Test list creation and destruction
@@ -355,6 +477,1687 @@ void test_circular_structure(void) {
   TEST_ASSERT_NULL(lst_);
 }
 
+// Test list creation when the list struct cannot be allocated
+void test_init_oom_list(void)
+{
+  list_set_allocator(failing_alloc, free);
+  alloc_budget_ = 0;
+  list_t *lst = list_init(destroy_data, compare_to);
+  TEST_ASSERT_NULL(lst);
+}
+
+// Test list creation when the sentinel cannot be allocated
+void test_init_oom_sentinel(void)
+{
+  list_set_allocator(failing_alloc, free);
+  alloc_budget_ = 1;
+  list_t *lst = list_init(destroy_data, compare_to);
+  TEST_ASSERT_NULL(lst);
+}
+
+// Test that a failed add leaves the list untouched
+void test_add_oom(void)
+{
+  populate_list();
+  list_set_allocator(failing_alloc, free);
+  alloc_budget_ = 0;
+  int *data = alloc_data(42);
+  TEST_ASSERT_NULL(list_add(lst_, data));
+  TEST_ASSERT_EQUAL_INT(5, lst_->size);
+
+  node_t *curr = lst_->head->next;
+  for (int i = 4; i >= 0; i--)
+    {
+      TEST_ASSERT_TRUE(*((int *)curr->data) == i);
+      curr = curr->next;
+    }
+  TEST_ASSERT_EQUAL_PTR(lst_->head, curr);
+  free(data);
+
+  // Once memory is available again adding works as usual
+  alloc_budget_ = -1;
+  TEST_ASSERT_EQUAL_PTR(lst_, list_add(lst_, alloc_data(5)));
+  TEST_ASSERT_EQUAL_INT(6, lst_->size);
+}
+
+// Test destroying a list on the reclaimer thread
+void test_destroy_async(void)
+{
+  destroyed_ = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_reclaimer_start());
+  list_t *lst = list_init(counting_destroy, compare_to);
+  for (int i = 0; i < 100; i++)
+    {
+      list_add(lst, alloc_data(i));
+    }
+  list_destroy_async(&lst);
+  TEST_ASSERT_NULL(lst);
+
+  populate_list();
+  list_reclaim(counting_destroy, list_remove_index(lst_, 0));
+
+  // Stopping drains everything that was handed off
+  list_reclaimer_stop();
+  TEST_ASSERT_EQUAL_INT(101, destroyed_);
+}
+
+/**
+ * Helper function, starts and stops the reclaimer over and over while
+ * handing it data.
+ */
+static void *restart_reclaimer(void *arg)
+{
+  (void)arg;
+  for (int i = 0; i < 200; i++)
+    {
+      list_reclaimer_start();
+      list_reclaim(free, alloc_data(i));
+      list_reclaimer_stop();
+    }
+  return NULL;
+}
+
+// Test starts and stops racing from several threads never lose the worker
+void test_reclaimer_restart(void)
+{
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++)
+    {
+      TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, restart_reclaimer, NULL));
+    }
+  for (int i = 0; i < 4; i++)
+    {
+      pthread_join(threads[i], NULL);
+    }
+  list_reclaimer_stop();
+  TEST_ASSERT_EQUAL_INT(0, list_reclaimer_start());
+  list_reclaimer_stop();
+}
+
+// Test that handoffs are destroyed inline when the reclaimer is not running
+void test_destroy_async_stopped(void)
+{
+  destroyed_ = 0;
+  list_t *lst = list_init(counting_destroy, compare_to);
+  list_add(lst, alloc_data(1));
+  list_destroy_async(&lst);
+  TEST_ASSERT_NULL(lst);
+  TEST_ASSERT_EQUAL_INT(1, destroyed_);
+  list_reclaim(counting_destroy, alloc_data(2));
+  TEST_ASSERT_EQUAL_INT(2, destroyed_);
+}
+
+// Test memory accounting with and without payload sizes
+void test_memory_stats(void)
+{
+  list_memory_stats_t stats;
+  TEST_ASSERT_EQUAL_INT(-1, list_memory_stats(NULL, &stats, NULL));
+  TEST_ASSERT_EQUAL_INT(0, list_memory_stats(lst_, &stats, NULL));
+  TEST_ASSERT_EQUAL_size_t(0, stats.nodes);
+  // The stats of a list built with LIST_STATS count as overhead too
+  size_t stats_bytes = lst_->stats ? sizeof(list_stats_t) : 0;
+  TEST_ASSERT_EQUAL_size_t(sizeof(list_t) + sizeof(node_t) + stats_bytes, stats.total_bytes);
+
+  // A node is its three pointers and two 32 bit counters, nothing more
+  TEST_ASSERT_EQUAL_size_t(3 * sizeof(void *) + 2 * sizeof(uint32_t), sizeof(node_t));
+
+  populate_list();
+  TEST_ASSERT_EQUAL_INT(0, list_memory_stats(lst_, &stats, data_size));
+  TEST_ASSERT_EQUAL_size_t(5, stats.nodes);
+  TEST_ASSERT_EQUAL_size_t(5 * sizeof(node_t), stats.node_bytes);
+  TEST_ASSERT_EQUAL_size_t(5 * sizeof(int), stats.payload_bytes);
+  TEST_ASSERT_EQUAL_size_t(stats.node_bytes + stats.overhead_bytes + stats.payload_bytes,
+                           stats.total_bytes);
+}
+
+#ifdef LIST_STATS
+// Test the operation counters
+void test_stats_counters(void)
+{
+  list_stats_t stats;
+  populate_list(); // List should be 4->3->2->1->0
+  int *data = alloc_data(1);
+  TEST_ASSERT_EQUAL_INT(3, list_indexof(lst_, data));
+  *data = 22;
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, data));
+  free(data);
+  free(list_remove_index(lst_, 2));
+
+  TEST_ASSERT_EQUAL_INT(0, list_stats(lst_, &stats));
+  TEST_ASSERT_EQUAL_UINT64(5, stats.adds);
+  TEST_ASSERT_EQUAL_UINT64(1, stats.removes);
+  TEST_ASSERT_EQUAL_UINT64(1, stats.indexof_hits);
+  TEST_ASSERT_EQUAL_UINT64(1, stats.indexof_misses);
+  TEST_ASSERT_EQUAL_UINT64(9, stats.comparisons);
+  TEST_ASSERT_EQUAL_UINT64(12, stats.nodes_traversed);
+
+  // Every operation lands in exactly one latency bucket
+  uint64_t recorded[LIST_OP_COUNT] = { 0 };
+  for (int op = 0; op < LIST_OP_COUNT; op++)
+    {
+      for (int i = 0; i < LIST_LATENCY_BUCKETS; i++)
+        {
+          recorded[op] += stats.latency[op][i];
+        }
+    }
+  TEST_ASSERT_EQUAL_UINT64(5, recorded[LIST_OP_ADD]);
+  TEST_ASSERT_EQUAL_UINT64(1, recorded[LIST_OP_REMOVE]);
+  TEST_ASSERT_EQUAL_UINT64(2, recorded[LIST_OP_INDEXOF]);
+
+  list_stats_reset(lst_);
+  TEST_ASSERT_EQUAL_INT(0, list_stats(lst_, &stats));
+  TEST_ASSERT_EQUAL_UINT64(0, stats.adds);
+}
+
+// Test dumping the stats as text and JSON
+void test_stats_dump(void)
+{
+  char buf[4096];
+  populate_list();
+  FILE *out = fmemopen(buf, sizeof(buf), "w");
+  TEST_ASSERT_EQUAL_INT(0, list_stats_dump(lst_, out, true));
+  fclose(out);
+  TEST_ASSERT_EQUAL_INT('{', buf[0]);
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"adds\":5"));
+
+  out = fmemopen(buf, sizeof(buf), "w");
+  TEST_ASSERT_EQUAL_INT(0, list_stats_dump(lst_, out, false));
+  fclose(out);
+  TEST_ASSERT_NOT_NULL(strstr(buf, "adds:            5"));
+}
+#endif
+
+/**
+ * Helper function, checks that the list holds exactly the expected values
+ * in both directions.
+ */
+static void assert_list_equals(list_t *lst, const int *expected, size_t n)
+{
+  TEST_ASSERT_EQUAL_size_t(n, lst->size);
+  node_t *curr = lst->head->next;
+  for (size_t i = 0; i < n; i++)
+    {
+      TEST_ASSERT_EQUAL_INT(expected[i], *((int *)curr->data));
+      curr = curr->next;
+    }
+  TEST_ASSERT_EQUAL_PTR(lst->head, curr);
+  curr = lst->head->prev;
+  for (size_t i = n; i > 0; i--)
+    {
+      TEST_ASSERT_EQUAL_INT(expected[i - 1], *((int *)curr->data));
+      curr = curr->prev;
+    }
+  TEST_ASSERT_EQUAL_PTR(lst->head, curr);
+}
+
+// Test the move to front policy
+void test_policy_move_to_front(void)
+{
+  populate_list(); // List should be 4->3->2->1->0
+  list_set_policy(lst_, LIST_POLICY_MOVE_TO_FRONT);
+  int key = 1;
+  TEST_ASSERT_EQUAL_INT(3, list_indexof(lst_, &key));
+  const int expected[] = { 1, 4, 3, 2, 0 };
+  assert_list_equals(lst_, expected, 5);
+  TEST_ASSERT_EQUAL_INT(0, list_indexof(lst_, &key));
+  assert_list_equals(lst_, expected, 5);
+}
+
+// Test the transpose policy
+void test_policy_transpose(void)
+{
+  populate_list(); // List should be 4->3->2->1->0
+  list_set_policy(lst_, LIST_POLICY_TRANSPOSE);
+  int key = 0;
+  TEST_ASSERT_EQUAL_INT(4, list_indexof(lst_, &key));
+  const int once[] = { 4, 3, 2, 0, 1 };
+  assert_list_equals(lst_, once, 5);
+  key = 3;
+  TEST_ASSERT_EQUAL_INT(1, list_indexof(lst_, &key));
+  const int twice[] = { 3, 4, 2, 0, 1 };
+  assert_list_equals(lst_, twice, 5);
+  TEST_ASSERT_EQUAL_INT(0, list_indexof(lst_, &key));
+  assert_list_equals(lst_, twice, 5);
+}
+
+// Test the frequency ordered policy
+void test_policy_frequency(void)
+{
+  populate_list(); // List should be 4->3->2->1->0
+  list_set_policy(lst_, LIST_POLICY_FREQUENCY);
+  int key = 0;
+  list_indexof(lst_, &key);
+  list_indexof(lst_, &key);
+  key = 2;
+  list_indexof(lst_, &key);
+  const int expected[] = { 0, 2, 4, 3, 1 };
+  assert_list_equals(lst_, expected, 5);
+  // Ties keep the element that got there first in front
+  TEST_ASSERT_EQUAL_INT(1, list_indexof(lst_, &key));
+  const int tied[] = { 0, 2, 4, 3, 1 };
+  assert_list_equals(lst_, tied, 5);
+  TEST_ASSERT_EQUAL_INT(1, list_indexof(lst_, &key));
+  const int passed[] = { 2, 0, 4, 3, 1 };
+  assert_list_equals(lst_, passed, 5);
+}
+
+#ifdef LIST_TRACE
+// Test that operations are captured in a binary trace
+void test_trace_capture(void)
+{
+  char path[] = "/tmp/test-lab-trace-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  close(fd);
+
+  TEST_ASSERT_EQUAL_INT(0, list_trace_open(path));
+  TEST_ASSERT_EQUAL_INT(-1, list_trace_open(path));
+  populate_list(); // List should be 4->3->2->1->0
+  int key = 1;
+  list_indexof(lst_, &key);
+  key = 22;
+  list_indexof(lst_, &key);
+  free(list_remove_index(lst_, 2));
+  list_insert_at(lst_, 3, alloc_data(9)); // 4->3->1->9->0
+  free(list_remove_node(lst_, lst_->head->next->next));
+  list_trace_close();
+
+  FILE *in = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(in);
+  list_trace_header_t header;
+  TEST_ASSERT_EQUAL_size_t(1, fread(&header, sizeof(header), 1, in));
+  TEST_ASSERT_EQUAL_UINT32(LIST_TRACE_MAGIC, header.magic);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(list_trace_record_t), header.record_size);
+
+  list_trace_record_t recs[11];
+  TEST_ASSERT_EQUAL_size_t(10, fread(recs, sizeof(recs[0]), 11, in));
+  fclose(in);
+  unlink(path);
+
+  for (int i = 0; i < 10; i++)
+    {
+      TEST_ASSERT_EQUAL_UINT32(lst_->id, recs[i].list_id);
+    }
+  TEST_ASSERT_EQUAL_UINT8(LIST_OP_ADD, recs[4].op);
+  TEST_ASSERT_EQUAL_UINT8(LIST_OP_INDEXOF, recs[5].op);
+  TEST_ASSERT_EQUAL_UINT64(3, recs[5].index);
+  TEST_ASSERT_EQUAL_UINT64(4, recs[5].traversed);
+  TEST_ASSERT_EQUAL_UINT8(1, recs[5].hit);
+  TEST_ASSERT_EQUAL_UINT8(0, recs[6].hit);
+  TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, recs[6].index);
+  TEST_ASSERT_EQUAL_UINT64(5, recs[6].traversed);
+  TEST_ASSERT_EQUAL_UINT8(LIST_OP_REMOVE, recs[7].op);
+  TEST_ASSERT_EQUAL_UINT64(2, recs[7].index);
+  TEST_ASSERT_TRUE(recs[7].tsc >= recs[0].tsc);
+
+  // Inserts record where they went and the walk from the closer end
+  TEST_ASSERT_EQUAL_UINT8(LIST_OP_ADD, recs[8].op);
+  TEST_ASSERT_EQUAL_UINT64(3, recs[8].index);
+  TEST_ASSERT_EQUAL_UINT64(1, recs[8].traversed);
+  // Removing a node the caller holds has no index to record
+  TEST_ASSERT_EQUAL_UINT8(LIST_OP_UNLINK, recs[9].op);
+  TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, recs[9].index);
+  TEST_ASSERT_EQUAL_UINT64(0, recs[9].traversed);
+}
+#endif
+
+// Test that reading a trace merges the rings of two threads by timestamp
+void test_trace_read(void)
+{
+  char path[] = "/tmp/test-lab-trace-read-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  FILE *out = fdopen(fd, "wb");
+  TEST_ASSERT_NOT_NULL(out);
+  list_trace_header_t header = { LIST_TRACE_MAGIC, LIST_TRACE_VERSION, sizeof(list_trace_record_t),
+                                 LIST_TRACE_CLOCK_NS };
+  // Each ring was flushed in one go, the second thread's tied record at 30
+  // comes later in the file so it must stay behind the first thread's
+  list_trace_record_t recs[6] = { 0 };
+  const uint64_t tsc[6] = { 10, 30, 50, 20, 30, 60 };
+  for (int i = 0; i < 6; i++)
+    {
+      recs[i].tsc = tsc[i];
+      recs[i].list_id = i < 3 ? 1 : 2;
+      recs[i].index = (uint64_t)i;
+    }
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(recs, sizeof(recs[0]), 6, out);
+  fclose(out);
+
+  FILE *in = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(in);
+  list_trace_header_t read_header;
+  size_t count = 0;
+  list_trace_record_t *merged = list_trace_read(in, &read_header, &count);
+  fclose(in);
+  unlink(path);
+  TEST_ASSERT_NOT_NULL(merged);
+  TEST_ASSERT_EQUAL_size_t(6, count);
+  TEST_ASSERT_EQUAL_UINT32(LIST_TRACE_CLOCK_NS, read_header.clock);
+  const uint64_t expected[6] = { 0, 3, 1, 4, 2, 5 };
+  for (int i = 0; i < 6; i++)
+    {
+      TEST_ASSERT_EQUAL_UINT64(expected[i], merged[i].index);
+    }
+  list_trace_free(merged);
+
+  // Anything else is rejected
+  in = tmpfile();
+  TEST_ASSERT_NOT_NULL(in);
+  fputs("not a trace at all", in);
+  rewind(in);
+  TEST_ASSERT_NULL(list_trace_read(in, &read_header, &count));
+  fclose(in);
+}
+
+// Test saving and loading a snapshot
+void test_save_load(void)
+{
+  char path[] = "/tmp/test-lab-snapshot-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  close(fd);
+
+  populate_list(); // List should be 4->3->2->1->0
+  TEST_ASSERT_EQUAL_INT(0, list_save(lst_, path, &int_codec_));
+  list_t *lst = list_load(path, &int_codec_, destroy_data, compare_to);
+  TEST_ASSERT_NOT_NULL(lst);
+  const int expected[] = { 4, 3, 2, 1, 0 };
+  assert_list_equals(lst, expected, 5);
+
+  // Loaded lists behave like any other list
+  free(list_remove_index(lst, 1));
+  list_add(lst, alloc_data(7));
+  const int changed[] = { 7, 4, 2, 1, 0 };
+  assert_list_equals(lst, changed, 5);
+
+  // The node freed from the block is slack until the block goes away
+  list_memory_stats_t stats;
+  list_memory_stats(lst, &stats, NULL);
+  TEST_ASSERT_EQUAL_size_t(sizeof(node_t), stats.slack_bytes);
+
+  // Blocks are counted once each, however many of their nodes are visited
+  list_t *more = list_load(path, &int_codec_, destroy_data, compare_to);
+  TEST_ASSERT_NOT_NULL(more);
+  free(list_remove_index(more, 4));
+  free(list_remove_index(more, 3));
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst, more, false));
+  list_memory_stats(lst, &stats, NULL);
+  TEST_ASSERT_EQUAL_size_t(3 * sizeof(node_t), stats.slack_bytes);
+  list_destroy(&more);
+  list_destroy(&lst);
+
+  // Empty lists round trip too
+  list_t *empty = list_init(destroy_data, compare_to);
+  TEST_ASSERT_EQUAL_INT(0, list_save(empty, path, &int_codec_));
+  list_destroy(&empty);
+  lst = list_load(path, &int_codec_, destroy_data, compare_to);
+  TEST_ASSERT_NOT_NULL(lst);
+  assert_list_equals(lst, NULL, 0);
+  list_destroy(&lst);
+  unlink(path);
+}
+
+// Test that a damaged snapshot is rejected
+void test_load_corrupt(void)
+{
+  char path[] = "/tmp/test-lab-snapshot-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  close(fd);
+
+  populate_list();
+  TEST_ASSERT_EQUAL_INT(0, list_save(lst_, path, &int_codec_));
+  FILE *f = fopen(path, "r+b");
+  fseek(f, -3, SEEK_END);
+  fputc(0x5a, f);
+  fclose(f);
+  TEST_ASSERT_NULL(list_load(path, &int_codec_, destroy_data, compare_to));
+
+  // A failed allocation part way through leaves nothing behind
+  TEST_ASSERT_EQUAL_INT(0, list_save(lst_, path, &int_codec_));
+  list_set_allocator(failing_alloc, free);
+  alloc_budget_ = 2;
+  TEST_ASSERT_NULL(list_load(path, &int_codec_, destroy_data, compare_to));
+
+  // So does a decode failing part way into a list that does not own its data
+  list_set_allocator(NULL, NULL);
+  TEST_ASSERT_EQUAL_INT(0, list_save(lst_, path, &int_codec_));
+  TEST_ASSERT_NULL(list_load(path, &static_codec_, NULL, compare_to));
+  unlink(path);
+}
+
+// Test searching and walking a mapped snapshot
+void test_view(void)
+{
+  char path[] = "/tmp/test-lab-snapshot-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  close(fd);
+
+  populate_list(); // List should be 4->3->2->1->0
+  TEST_ASSERT_EQUAL_INT(0, list_save(lst_, path, &int_codec_));
+  list_view_t *view = list_view_open(path, compare_encoded);
+  TEST_ASSERT_NOT_NULL(view);
+  TEST_ASSERT_EQUAL_size_t(5, list_view_size(view));
+  TEST_ASSERT_EQUAL_INT(0, list_view_verify(view));
+
+  int key = 1;
+  TEST_ASSERT_EQUAL_INT(3, list_view_indexof(view, &key));
+  key = 4;
+  TEST_ASSERT_EQUAL_INT(0, list_view_indexof(view, &key));
+  key = 22;
+  TEST_ASSERT_EQUAL_INT(-1, list_view_indexof(view, &key));
+
+  int sum = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_view_foreach(view, sum_encoded, &sum));
+  TEST_ASSERT_EQUAL_INT(10, sum);
+
+  list_view_close(&view);
+  TEST_ASSERT_NULL(view);
+
+  // Something that is not a snapshot is refused
+  FILE *f = fopen(path, "wb");
+  fputs("not a snapshot, not even close to one", f);
+  fclose(f);
+  TEST_ASSERT_NULL(list_view_open(path, compare_encoded));
+  unlink(path);
+}
+
+/**
+ * Helper function, counts and sums the elements visited by list_foreach.
+ */
+static int sum_data(void *data, void *ctx)
+{
+  *(long *)ctx += *(int *)data;
+  return 0;
+}
+
+/**
+ * Helper function, stops list_foreach at the first element equal to ctx.
+ */
+static int stop_at(void *data, void *ctx)
+{
+  return *(int *)data == *(int *)ctx ? 7 : 0;
+}
+
+// Test list_foreach
+void test_foreach(void)
+{
+  long sum = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_foreach(lst_, sum_data, &sum));
+  TEST_ASSERT_EQUAL_INT(0, sum);
+  populate_list();
+  TEST_ASSERT_EQUAL_INT(0, list_foreach(lst_, sum_data, &sum));
+  TEST_ASSERT_EQUAL_INT(10, sum);
+  int stop = 2;
+  TEST_ASSERT_EQUAL_INT(7, list_foreach(lst_, stop_at, &stop));
+  TEST_ASSERT_EQUAL_INT(-1, list_foreach(NULL, stop_at, &stop));
+}
+
+// Test walks over lists long enough to use the jump array
+void test_long_list_walks(void)
+{
+  const int n = 1000;
+  list_set_jump_index(lst_, true);
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is n-1 ... 0
+    }
+  for (unsigned distance = 0; distance <= 16; distance += 8)
+    {
+      list_set_prefetch_distance(distance);
+      // The first walk stops early, the next ones go past what it recorded
+      int key = n - 10;
+      TEST_ASSERT_EQUAL_INT(9, list_indexof(lst_, &key));
+      key = 0;
+      TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key));
+      TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key));
+      long sum = 0;
+      list_foreach(lst_, sum_data, &sum);
+      TEST_ASSERT_EQUAL_INT((long)n * (n - 1) / 2, sum);
+    }
+
+  // Removing through the jump array and walking again after the change
+  int *rval = list_remove_index(lst_, 500);
+  TEST_ASSERT_EQUAL_INT(n - 501, *rval);
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, rval));
+  free(rval);
+  int key = n - 502;
+  TEST_ASSERT_EQUAL_INT(500, list_indexof(lst_, &key));
+  rval = list_remove_index(lst_, 998);
+  TEST_ASSERT_EQUAL_INT(0, *rval);
+  free(rval);
+  TEST_ASSERT_EQUAL_size_t(n - 2, lst_->size);
+  list_set_prefetch_distance(8);
+}
+
+// Test walks leave the list untouched unless the jump array is turned on
+void test_jump_index_opt_in(void)
+{
+  const int n = 1000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i));
+    }
+  int key = 0;
+  long sum = 0;
+  TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key));
+  list_foreach(lst_, sum_data, &sum);
+  TEST_ASSERT_NULL(lst_->jump);
+  TEST_ASSERT_EQUAL_size_t(0, lst_->jump_len);
+
+  list_set_jump_index(lst_, true);
+  TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key));
+  TEST_ASSERT_EQUAL_size_t(n, lst_->jump_len);
+
+  // A walk about to change the list does not extend the array
+  free(list_remove_index(lst_, n - 1));
+  free(list_remove_index(lst_, n - 2));
+  TEST_ASSERT_EQUAL_size_t(0, lst_->jump_len);
+
+  // A reordering policy relinks the node found, so the walk does not extend either
+  list_set_policy(lst_, LIST_POLICY_MOVE_TO_FRONT);
+  key = 2;
+  TEST_ASSERT_EQUAL_INT(n - 3, list_indexof(lst_, &key));
+  TEST_ASSERT_EQUAL_size_t(0, lst_->jump_len);
+
+  list_set_jump_index(lst_, false);
+  TEST_ASSERT_NULL(lst_->jump);
+  TEST_ASSERT_EQUAL_size_t(0, lst_->jump_cap);
+}
+
+/**
+ * Helper function, checks that the nodes of the list sit next to each other
+ * in memory in list order.
+ */
+static void assert_contiguous(list_t *lst)
+{
+  for (node_t *curr = lst->head->next; curr->next != lst->head; curr = curr->next)
+    {
+      TEST_ASSERT_EQUAL_PTR(curr + 1, curr->next);
+    }
+}
+
+// Test compacting the whole list at once
+void test_compact(void)
+{
+  for (int i = 0; i < 10; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is 9 ... 0
+    }
+  free(list_remove_index(lst_, 3));
+  free(list_remove_index(lst_, 0));
+  TEST_ASSERT_EQUAL_INT(0, list_compact(lst_));
+  const int expected[] = { 8, 7, 5, 4, 3, 2, 1, 0 };
+  assert_list_equals(lst_, expected, 8);
+  assert_contiguous(lst_);
+
+  // Compacting an already compact list frees the old block
+  TEST_ASSERT_EQUAL_INT(0, list_compact(lst_));
+  assert_list_equals(lst_, expected, 8);
+  assert_contiguous(lst_);
+  list_memory_stats_t stats;
+  list_memory_stats(lst_, &stats, NULL);
+  TEST_ASSERT_EQUAL_size_t(0, stats.slack_bytes);
+
+  // The list stays usable
+  list_add(lst_, alloc_data(42));
+  free(list_remove_index(lst_, 8));
+  const int changed[] = { 42, 8, 7, 5, 4, 3, 2, 1 };
+  assert_list_equals(lst_, changed, 8);
+
+  // Out of memory leaves the list as it was
+  list_set_allocator(failing_alloc, free);
+  alloc_budget_ = 0;
+  TEST_ASSERT_EQUAL_INT(-1, list_compact(lst_));
+  assert_list_equals(lst_, changed, 8);
+}
+
+// Test compacting a few nodes at a time while the list changes
+void test_compact_step(void)
+{
+  for (int i = 0; i < 10; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is 9 ... 0
+    }
+  TEST_ASSERT_EQUAL_INT(1, list_compact_step(lst_, 3)); // 9 8 7 moved
+  list_add(lst_, alloc_data(10));                       // Not part of this pass
+  free(list_remove_index(lst_, 4));                     // Removes 6, the next to move
+  TEST_ASSERT_EQUAL_INT(1, list_compact_step(lst_, 3)); // 5 4 3 moved
+  free(list_remove_index(lst_, 1));                     // Removes a moved node
+  TEST_ASSERT_EQUAL_INT(0, list_compact_step(lst_, 100));
+  const int expected[] = { 10, 8, 7, 5, 4, 3, 2, 1, 0 };
+  assert_list_equals(lst_, expected, 9);
+
+  // Nodes moved by the pass are next to each other
+  node_t *curr = lst_->head->next->next;
+  TEST_ASSERT_EQUAL_PTR(curr + 1, curr->next);
+  curr = curr->next->next;
+  for (int i = 0; i < 5; i++, curr = curr->next)
+    {
+      TEST_ASSERT_EQUAL_PTR(curr + 1, curr->next);
+    }
+
+  // A pass in progress is cleaned up with the list
+  TEST_ASSERT_EQUAL_INT(1, list_compact_step(lst_, 2));
+}
+
+// Test searching a large list with several threads
+void test_indexof_parallel(void)
+{
+  const int n = 20000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i % 5000)); // Every value 4 times
+    }
+  int key = 4999;
+  TEST_ASSERT_EQUAL_INT(0, list_indexof_parallel(lst_, &key, 4));
+  key = 0;
+  TEST_ASSERT_EQUAL_INT(4999, list_indexof_parallel(lst_, &key, 4));
+  key = 7;
+  TEST_ASSERT_EQUAL_INT(4992, list_indexof_parallel(lst_, &key, 3));
+  key = n;
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof_parallel(lst_, &key, 4));
+
+  // A change between searches is picked up
+  free(list_remove_index(lst_, 0));
+  key = 4999;
+  TEST_ASSERT_EQUAL_INT(4999, list_indexof_parallel(lst_, &key, 4));
+
+  // Small lists and a single thread take the sequential path
+  key = 4998;
+  TEST_ASSERT_EQUAL_INT(0, list_indexof_parallel(lst_, &key, 1));
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof_parallel(NULL, &key, 4));
+}
+
+// Test destroying a large list with several threads
+void test_destroy_parallel(void)
+{
+  destroyed_ = 0;
+  list_t *lst = list_init(counting_destroy, compare_to);
+  for (int i = 0; i < 20000; i++)
+    {
+      list_add(lst, alloc_data(i));
+    }
+  list_compact_step(lst, 100); // Part block, part single nodes
+  list_destroy_parallel(&lst, 4);
+  TEST_ASSERT_NULL(lst);
+  TEST_ASSERT_EQUAL_INT(20000, destroyed_);
+
+  // Small lists are destroyed inline
+  lst = list_init(counting_destroy, compare_to);
+  list_add(lst, alloc_data(1));
+  list_destroy_parallel(&lst, 4);
+  TEST_ASSERT_NULL(lst);
+  TEST_ASSERT_EQUAL_INT(20001, destroyed_);
+}
+
+/**
+ * Helper function, maps an integer to twice its value, fails on ctx.
+ */
+static void *double_data(void *data, void *ctx)
+{
+  int val = *(int *)data;
+  if (ctx != NULL && val == *(int *)ctx)
+    {
+      return NULL;
+    }
+  return alloc_data(2 * val);
+}
+
+/**
+ * Helper function, maps an element to itself, failing on the one equal to ctx.
+ */
+static void *same_data(void *data, void *ctx)
+{
+  return *(int *)data == *(int *)ctx ? NULL : data;
+}
+
+/**
+ * Helper function, adds an integer to a long accumulator.
+ */
+static void add_data(void *acc, void *data, void *ctx)
+{
+  (void)ctx;
+  *(long *)acc += *(int *)data;
+}
+
+/**
+ * Helper function, combines two long accumulators.
+ */
+static void add_partial(void *acc, const void *partial, void *ctx)
+{
+  (void)ctx;
+  *(long *)acc += *(const long *)partial;
+}
+
+/**
+ * Helper function, counts elements with atomic increments.
+ */
+static int count_data(void *data, void *ctx)
+{
+  (void)data;
+  __atomic_fetch_add((long *)ctx, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Test map and reduce
+void test_map_reduce(void)
+{
+  populate_list(); // List should be 4->3->2->1->0
+  list_t *mapped = list_map(lst_, double_data, NULL, destroy_data, compare_to);
+  TEST_ASSERT_NOT_NULL(mapped);
+  const int expected[] = { 8, 6, 4, 2, 0 };
+  assert_list_equals(mapped, expected, 5);
+  assert_contiguous(mapped);
+
+  long sum = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_reduce(mapped, &sum, add_data, NULL));
+  TEST_ASSERT_EQUAL_INT(20, sum);
+  list_destroy(&mapped);
+
+  // A failing map leaves nothing behind
+  int fail = 2;
+  TEST_ASSERT_NULL(list_map(lst_, double_data, &fail, destroy_data, compare_to));
+
+  list_t *empty = list_init(destroy_data, compare_to);
+  mapped = list_map(empty, double_data, NULL, destroy_data, compare_to);
+  assert_list_equals(mapped, NULL, 0);
+  list_destroy(&mapped);
+  list_destroy(&empty);
+}
+
+// Test the parallel map, reduce and foreach
+void test_map_reduce_parallel(void)
+{
+  const int n = 20000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is n-1 ... 0
+    }
+
+  list_t *mapped = list_map_parallel(lst_, double_data, NULL, destroy_data, compare_to, 4);
+  TEST_ASSERT_NOT_NULL(mapped);
+  TEST_ASSERT_EQUAL_size_t(n, mapped->size);
+  int key = 2 * (n - 1);
+  TEST_ASSERT_EQUAL_INT(0, list_indexof(mapped, &key));
+  key = 0;
+  TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(mapped, &key));
+
+  long accs[4] = { 0 };
+  TEST_ASSERT_EQUAL_INT(0, list_reduce_parallel(mapped, accs, sizeof(long), add_data, add_partial, NULL, 4));
+  TEST_ASSERT_EQUAL_INT((long)n * (n - 1), accs[0]);
+  list_destroy(&mapped);
+
+  long count = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_foreach_parallel(lst_, count_data, &count, 4));
+  TEST_ASSERT_EQUAL_INT(n, count);
+  int stop = 1234;
+  TEST_ASSERT_EQUAL_INT(7, list_foreach_parallel(lst_, stop_at, &stop, 4));
+
+  int fail = 5000;
+  TEST_ASSERT_NULL(list_map_parallel(lst_, double_data, &fail, destroy_data, compare_to, 4));
+  // A list that does not own its data fails the same way
+  TEST_ASSERT_NULL(list_map_parallel(lst_, same_data, &fail, NULL, compare_to, 4));
+}
+
+/**
+ * Helper function, checks the parallel search, foreach and map agree with
+ * their sequential versions on lst.
+ */
+static void assert_parallel_matches(list_t *lst)
+{
+  for (int key = -1; key < 21000; key += 611)
+    {
+      TEST_ASSERT_EQUAL_INT(list_indexof(lst, &key), list_indexof_parallel(lst, &key, 4));
+    }
+  int key = *(int *)lst->head->prev->data;
+  TEST_ASSERT_EQUAL_INT((int)lst->size - 1, list_indexof_parallel(lst, &key, 4));
+
+  long count = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_foreach_parallel(lst, count_data, &count, 4));
+  TEST_ASSERT_EQUAL_INT(lst->size, count);
+
+  list_t *mapped = list_map_parallel(lst, double_data, NULL, destroy_data, compare_to, 4);
+  TEST_ASSERT_NOT_NULL(mapped);
+  TEST_ASSERT_EQUAL_size_t(lst->size, mapped->size);
+  node_t *m = mapped->head->next;
+  for (node_t *curr = lst->head->next; curr != lst->head; curr = curr->next, m = m->next)
+    {
+      TEST_ASSERT_EQUAL_INT(2 * *(int *)curr->data, *(int *)m->data);
+    }
+  list_destroy(&mapped);
+}
+
+// Test the parallel operations keep up with every kind of change to the list
+void test_parallel_after_changes(void)
+{
+  const int n = 20000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is n-1 ... 0
+    }
+  assert_parallel_matches(lst_);
+
+  // Changes at known positions, one of them emptying whole segments
+  for (int i = 0; i < 500; i++)
+    {
+      list_add(lst_, alloc_data(n + i));
+      list_insert_at(lst_, (size_t)i * 37 % lst_->size, alloc_data(n + 500 + i));
+    }
+  TEST_ASSERT_EQUAL_INT(4, list_remove_indices(lst_, (size_t[]){ 0, 1, 5000, 19000 }, 4, NULL));
+  for (int i = 0; i < 1000; i++)
+    {
+      free(list_remove_index(lst_, 3000));
+    }
+  free(list_remove_index(lst_, lst_->size - 1));
+  assert_parallel_matches(lst_);
+
+  // Changes at positions the list does not know
+  for (int i = 0; i < 300; i++)
+    {
+      free(list_remove_node(lst_, lst_->head->next->next->next));
+      list_handle_t handle = list_add_handle(lst_, alloc_data(n + 1000 + i));
+      list_handle_move_to_front(lst_, handle);
+    }
+  list_set_policy(lst_, LIST_POLICY_TRANSPOSE);
+  for (int key = 100; key < 200; key++)
+    {
+      list_indexof(lst_, &key);
+    }
+  list_set_policy(lst_, LIST_POLICY_NONE);
+  assert_parallel_matches(lst_);
+
+  // A compaction pass that is running moves the nodes the segments start at
+  TEST_ASSERT_EQUAL_INT(1, list_compact_step(lst_, 4000));
+  assert_parallel_matches(lst_);
+  free(list_remove_index(lst_, 4001));
+  list_insert_at(lst_, 4000, alloc_data(-2));
+  while (list_compact_step(lst_, 1500) == 1)
+    {
+      free(list_remove_node(lst_, lst_->head->prev));
+      assert_parallel_matches(lst_);
+    }
+  assert_parallel_matches(lst_);
+
+  // Splices and splits
+  list_t *other = list_init(destroy_data, compare_to);
+  for (int i = 0; i < 100; i++)
+    {
+      list_add(other, alloc_data(-10 - i));
+    }
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, other, true));
+  for (int i = 0; i < 100; i++)
+    {
+      list_add(other, alloc_data(-200 - i));
+    }
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, other, false));
+  list_destroy(&other);
+  assert_parallel_matches(lst_);
+  list_t *rest = list_split_at(lst_, 12345);
+  TEST_ASSERT_NOT_NULL(rest);
+  assert_parallel_matches(lst_);
+  assert_parallel_matches(rest);
+  list_destroy(&rest);
+}
+
+// Test the executor the parallel operations run on
+void test_executor(void)
+{
+  const int n = 20000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is n-1 ... 0
+    }
+
+  list_executor_stop();
+  TEST_ASSERT_EQUAL_size_t(0, list_executor_size());
+  TEST_ASSERT_EQUAL_INT(0, list_executor_start(3));
+  TEST_ASSERT_EQUAL_INT(-1, list_executor_start(2));
+  TEST_ASSERT_EQUAL_size_t(3, list_executor_size());
+
+  // More tasks than workers, the rest are queued and stolen
+  for (int key = 0; key < n; key += 997)
+    {
+      TEST_ASSERT_EQUAL_INT(n - 1 - key, list_indexof_parallel(lst_, &key, 8));
+    }
+  long accs[8] = { 0 };
+  TEST_ASSERT_EQUAL_INT(0, list_reduce_parallel(lst_, accs, sizeof(long), add_data, add_partial, NULL, 8));
+  TEST_ASSERT_EQUAL_INT((long)n * (n - 1) / 2, accs[0]);
+
+  // Stopping is not the end, the next parallel operation starts it again
+  list_executor_stop();
+  TEST_ASSERT_EQUAL_size_t(0, list_executor_size());
+  long count = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_foreach_parallel(lst_, count_data, &count, 4));
+  TEST_ASSERT_EQUAL_INT(n, count);
+  list_executor_stop();
+  TEST_ASSERT_EQUAL_INT(0, list_executor_start(2));
+}
+
+// Test moving whole chains between lists
+void test_splice_concat(void)
+{
+  list_t *other = list_init(destroy_data, compare_to);
+  for (int i = 0; i < 3; i++)
+    {
+      list_add(lst_, alloc_data(i));
+      list_add(other, alloc_data(10 + i));
+    }
+
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, other, true));
+  int front[] = { 12, 11, 10, 2, 1, 0 };
+  assert_list_equals(lst_, front, 6);
+  assert_list_equals(other, NULL, 0);
+
+  // Splicing an empty list changes nothing, the emptied list is usable again
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, other, false));
+  assert_list_equals(lst_, front, 6);
+  list_add(other, alloc_data(20));
+  list_add(other, alloc_data(21));
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, other, false));
+  int back[] = { 12, 11, 10, 2, 1, 0, 21, 20 };
+  assert_list_equals(lst_, back, 8);
+
+  list_add(other, alloc_data(30));
+  TEST_ASSERT_EQUAL_PTR(lst_, list_concat(lst_, &other));
+  TEST_ASSERT_NULL(other);
+  int all[] = { 12, 11, 10, 2, 1, 0, 21, 20, 30 };
+  assert_list_equals(lst_, all, 9);
+
+  TEST_ASSERT_EQUAL_INT(-1, list_splice(lst_, lst_, true));
+  TEST_ASSERT_EQUAL_INT(-1, list_splice(lst_, NULL, true));
+  TEST_ASSERT_NULL(list_concat(lst_, &other));
+}
+
+// Test cutting a list in two
+void test_split(void)
+{
+  for (int i = 0; i < 6; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is 5 ... 0
+    }
+
+  list_t *rest = list_split_at(lst_, 4);
+  TEST_ASSERT_NOT_NULL(rest);
+  int head[] = { 5, 4, 3, 2 };
+  int tail[] = { 1, 0 };
+  assert_list_equals(lst_, head, 4);
+  assert_list_equals(rest, tail, 2);
+
+  // Cut at a node, then the empty cuts at either end
+  list_t *mid = list_split_at_node(lst_, lst_->head->next->next->next);
+  int two[] = { 3, 2 };
+  assert_list_equals(lst_, head, 2);
+  assert_list_equals(mid, two, 2);
+  list_t *empty = list_split_at(mid, 2);
+  assert_list_equals(empty, NULL, 0);
+  list_t *whole = list_split_at(mid, 0);
+  assert_list_equals(mid, NULL, 0);
+  assert_list_equals(whole, two, 2);
+
+  TEST_ASSERT_NULL(list_split_at(lst_, 3));
+  TEST_ASSERT_NULL(list_split_at_node(lst_, rest->head->next));
+
+  // Put it back together
+  list_concat(lst_, &whole);
+  list_concat(lst_, &rest);
+  int orig[] = { 5, 4, 3, 2, 1, 0 };
+  assert_list_equals(lst_, orig, 6);
+  list_destroy(&mid);
+  list_destroy(&empty);
+}
+
+// Test splitting a large list keeps the jump array and compaction consistent
+void test_split_large(void)
+{
+  const int n = 2000;
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is n-1 ... 0
+    }
+  int key = 0;
+  list_set_jump_index(lst_, true);
+  TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key)); // Builds the jump array
+  TEST_ASSERT_EQUAL_INT(1, list_compact_step(lst_, 1500));
+
+  list_t *rest = list_split_at(lst_, 1200);
+  TEST_ASSERT_EQUAL_size_t(1200, lst_->size);
+  TEST_ASSERT_EQUAL_size_t(n - 1200, rest->size);
+  int *data = list_remove_index(lst_, 1199);
+  TEST_ASSERT_EQUAL_INT(n - 1200, *data);
+  free(data);
+  key = 0;
+  TEST_ASSERT_EQUAL_INT(n - 1201, list_indexof(rest, &key));
+  TEST_ASSERT_EQUAL_INT(0, list_compact(rest));
+
+  // Splitting far from the front walks back from the tail
+  list_t *last = list_split_at(rest, rest->size - 1);
+  TEST_ASSERT_EQUAL_size_t(1, last->size);
+  TEST_ASSERT_EQUAL_INT(0, *(int *)last->head->next->data);
+  list_destroy(&last);
+  list_destroy(&rest);
+}
+
+// Test positional insert and random access
+void test_insert_get_set(void)
+{
+  TEST_ASSERT_EQUAL_PTR(lst_, list_insert_at(lst_, 0, alloc_data(1)));
+  list_insert_at(lst_, 1, alloc_data(3));
+  list_insert_at(lst_, 1, alloc_data(2));
+  list_insert_at(lst_, 0, alloc_data(0));
+  list_insert_at(lst_, 4, alloc_data(5));
+  list_insert_at(lst_, 4, alloc_data(4));
+  int expected[] = { 0, 1, 2, 3, 4, 5 };
+  assert_list_equals(lst_, expected, 6);
+
+  for (int i = 0; i < 6; i++)
+    {
+      TEST_ASSERT_EQUAL_INT(i, *(int *)list_get(lst_, i));
+    }
+  int *old = list_set(lst_, 4, alloc_data(40));
+  TEST_ASSERT_EQUAL_INT(4, *old);
+  free(old);
+  TEST_ASSERT_EQUAL_INT(40, *(int *)list_get(lst_, 4));
+
+  int *data = alloc_data(9);
+  TEST_ASSERT_NULL(list_insert_at(lst_, 7, data));
+  TEST_ASSERT_NULL(list_set(lst_, 6, data));
+  TEST_ASSERT_NULL(list_get(lst_, 6));
+  TEST_ASSERT_NULL(list_get(NULL, 0));
+  TEST_ASSERT_EQUAL_size_t(6, lst_->size);
+  free(data);
+}
+
+// Test random access on a large list, through the jump array and from both ends
+void test_get_large(void)
+{
+  const int n = 1000;
+  for (int i = 0; i < n; i++)
+    {
+      list_insert_at(lst_, lst_->size, alloc_data(i)); // List is 0 ... n-1
+    }
+  for (int i = 0; i < n; i += 37)
+    {
+      TEST_ASSERT_EQUAL_INT(i, *(int *)list_get(lst_, i));
+    }
+  int key = n - 1;
+  list_set_jump_index(lst_, true);
+  TEST_ASSERT_EQUAL_INT(n - 1, list_indexof(lst_, &key)); // Builds the jump array
+  for (int i = 0; i < n; i += 37)
+    {
+      TEST_ASSERT_EQUAL_INT(i, *(int *)list_get(lst_, i));
+    }
+  list_insert_at(lst_, 500, alloc_data(-1));
+  TEST_ASSERT_EQUAL_INT(-1, *(int *)list_get(lst_, 500));
+  TEST_ASSERT_EQUAL_INT(500, *(int *)list_get(lst_, 501));
+}
+
+// Test removing by value and by node
+void test_remove_data_node(void)
+{
+  for (int i = 0; i < 5; i++)
+    {
+      list_add(lst_, alloc_data(i)); // List is 4 ... 0
+    }
+
+  int key = 2;
+  int *data = list_remove_data(lst_, &key);
+  TEST_ASSERT_NOT_NULL(data);
+  TEST_ASSERT_EQUAL_INT(2, *data);
+  free(data);
+  int after_data[] = { 4, 3, 1, 0 };
+  assert_list_equals(lst_, after_data, 4);
+  TEST_ASSERT_NULL(list_remove_data(lst_, &key));
+
+  data = list_remove_node(lst_, lst_->head->prev);
+  TEST_ASSERT_EQUAL_INT(0, *data);
+  free(data);
+  data = list_remove_node(lst_, lst_->head->next);
+  TEST_ASSERT_EQUAL_INT(4, *data);
+  free(data);
+  int after_node[] = { 3, 1 };
+  assert_list_equals(lst_, after_node, 2);
+
+  TEST_ASSERT_NULL(list_remove_node(lst_, lst_->head));
+  TEST_ASSERT_NULL(list_remove_node(lst_, NULL));
+  TEST_ASSERT_NULL(list_remove_data(NULL, &key));
+}
+
+// Test O(1) access through handles and their generations
+void test_handles(void)
+{
+  list_handle_t h[40];
+  for (int i = 0; i < 40; i++)
+    {
+      h[i] = list_add_handle(lst_, alloc_data(i)); // List is 39 ... 0
+      TEST_ASSERT_NOT_EQUAL(0, h[i].slot);
+    }
+  TEST_ASSERT_EQUAL_INT(7, *(int *)list_handle_get(lst_, h[7]));
+
+  TEST_ASSERT_EQUAL_INT(0, list_handle_move_to_front(lst_, h[0]));
+  TEST_ASSERT_EQUAL_INT(0, *(int *)list_get(lst_, 0));
+  int *old = list_handle_update(lst_, h[0], alloc_data(100));
+  TEST_ASSERT_EQUAL_INT(0, *old);
+  free(old);
+  TEST_ASSERT_EQUAL_INT(100, *(int *)list_get(lst_, 0));
+  TEST_ASSERT_NULL(list_handle_update(lst_, h[0], NULL)); // Rejected, the element stays
+  TEST_ASSERT_EQUAL_INT(100, *(int *)list_get(lst_, 0));
+
+  int *data = list_remove_handle(lst_, h[20]);
+  TEST_ASSERT_EQUAL_INT(20, *data);
+  free(data);
+  TEST_ASSERT_EQUAL_size_t(39, lst_->size);
+  TEST_ASSERT_FALSE(list_handle_valid(lst_, h[20]));
+  TEST_ASSERT_NULL(list_remove_handle(lst_, h[20]));
+  TEST_ASSERT_EQUAL_INT(-1, list_handle_move_to_front(lst_, h[20]));
+
+  // The slot is reused under a new generation, the old handle stays stale
+  list_handle_t reused = list_add_handle(lst_, alloc_data(200));
+  TEST_ASSERT_EQUAL_UINT32(h[20].slot, reused.slot);
+  TEST_ASSERT_NULL(list_handle_get(lst_, h[20]));
+  TEST_ASSERT_EQUAL_INT(200, *(int *)list_handle_get(lst_, reused));
+
+  // Removing by other means also makes the handle stale
+  int key = 5;
+  free(list_remove_data(lst_, &key));
+  TEST_ASSERT_FALSE(list_handle_valid(lst_, h[5]));
+
+  // Handles follow nodes through compaction
+  TEST_ASSERT_EQUAL_INT(0, list_compact(lst_));
+  TEST_ASSERT_EQUAL_INT(7, *(int *)list_handle_get(lst_, h[7]));
+  data = list_remove_handle(lst_, h[8]);
+  TEST_ASSERT_EQUAL_INT(8, *data);
+  free(data);
+
+  TEST_ASSERT_FALSE(list_handle_valid(lst_, (list_handle_t){ 0, 0 }));
+  TEST_ASSERT_FALSE(list_handle_valid(lst_, (list_handle_t){ 1000, 1 }));
+  TEST_ASSERT_FALSE(list_handle_valid(NULL, h[7]));
+}
+
+// Test handles of nodes that move to another list go stale
+void test_handles_split_splice(void)
+{
+  list_handle_t h[6];
+  for (int i = 0; i < 6; i++)
+    {
+      h[i] = list_add_handle(lst_, alloc_data(i)); // List is 5 ... 0
+    }
+  list_t *rest = list_split_at(lst_, 3);
+  for (int i = 0; i < 3; i++)
+    {
+      TEST_ASSERT_FALSE(list_handle_valid(lst_, h[i]));
+      TEST_ASSERT_TRUE(list_handle_valid(lst_, h[i + 3]));
+    }
+  list_handle_t moved = list_add_handle(rest, alloc_data(6));
+  TEST_ASSERT_EQUAL_INT(0, list_splice(lst_, rest, false));
+  TEST_ASSERT_FALSE(list_handle_valid(rest, moved));
+  TEST_ASSERT_EQUAL_INT(5, *(int *)list_handle_get(lst_, h[5]));
+  int expected[] = { 5, 4, 3, 6, 2, 1, 0 };
+  assert_list_equals(lst_, expected, 7);
+  list_destroy(&rest);
+}
+
+// Test a handle insertion that runs out of memory leaves the list untouched
+void test_handles_oom(void)
+{
+  list_add_handle(lst_, alloc_data(1));
+  alloc_budget_ = 0;
+  list_set_allocator(failing_alloc, NULL);
+  int *data = alloc_data(2);
+  TEST_ASSERT_EQUAL_UINT32(0, list_add_handle(lst_, data).slot);
+  list_set_allocator(NULL, NULL);
+  free(data);
+  TEST_ASSERT_EQUAL_size_t(1, lst_->size);
+}
+
+/**
+ * Helper function, hashes an integer for the cache tests.
+ */
+static uint64_t hash_int(const void *data)
+{
+  return (uint64_t)(*(const int *)data) * 0x9e3779b97f4a7c15ull;
+}
+
+/**
+ * Helper function, a hash that sends every integer to few buckets so the
+ * cache index sees long probe runs.
+ */
+static uint64_t collide_int(const void *data)
+{
+  return (uint64_t)(*(const int *)data % 3);
+}
+
+// Test the LRU cache evicts the least recently used element
+void test_lru(void)
+{
+  list_lru_t *lru = list_lru_init(3, hash_int, counting_destroy, compare_to);
+  TEST_ASSERT_NOT_NULL(lru);
+  destroyed_ = 0;
+  for (int i = 1; i <= 3; i++)
+    {
+      TEST_ASSERT_EQUAL_INT(0, list_lru_put(lru, alloc_data(i)));
+    }
+  int key = 1;
+  TEST_ASSERT_EQUAL_INT(1, *(int *)list_lru_get(lru, &key));
+
+  // 2 is now the least recently used
+  list_lru_put(lru, alloc_data(4));
+  TEST_ASSERT_EQUAL_size_t(3, list_lru_size(lru));
+  TEST_ASSERT_EQUAL_INT(1, destroyed_);
+  key = 2;
+  TEST_ASSERT_NULL(list_lru_get(lru, &key));
+
+  // Replacing an element destroys the old one and keeps the size
+  list_lru_put(lru, alloc_data(3));
+  TEST_ASSERT_EQUAL_INT(2, destroyed_);
+  TEST_ASSERT_EQUAL_size_t(3, list_lru_size(lru));
+
+  key = 4;
+  int *data = list_lru_remove(lru, &key);
+  TEST_ASSERT_EQUAL_INT(4, *data);
+  free(data);
+  TEST_ASSERT_NULL(list_lru_get(lru, &key));
+  TEST_ASSERT_NULL(list_lru_remove(lru, &key));
+
+  list_lru_stats_t stats;
+  TEST_ASSERT_EQUAL_INT(0, list_lru_stats(lru, &stats));
+  TEST_ASSERT_EQUAL_UINT64(1, stats.hits);
+  TEST_ASSERT_EQUAL_UINT64(2, stats.misses);
+  TEST_ASSERT_EQUAL_UINT64(5, stats.inserts);
+  TEST_ASSERT_EQUAL_UINT64(1, stats.evictions);
+
+  list_lru_destroy(&lru);
+  TEST_ASSERT_NULL(lru);
+  TEST_ASSERT_EQUAL_INT(4, destroyed_);
+  TEST_ASSERT_NULL(list_lru_init(0, hash_int, destroy_data, compare_to));
+  TEST_ASSERT_NULL(list_lru_init(3, hash_int, NULL, compare_to));
+}
+
+// Test the LRU cache against a simple model with colliding hashes
+void test_lru_model(void)
+{
+  enum { CAP = 16, KEYS = 40 };
+  list_lru_t *lru = list_lru_init(CAP, collide_int, destroy_data, compare_to);
+  int model[CAP]; // Most recent first
+  int len = 0;
+  unsigned seed = 1;
+  for (int op = 0; op < 5000; op++)
+    {
+      seed = seed * 1103515245u + 12345u;
+      int key = (int)((seed >> 16) % KEYS);
+      int at = -1;
+      for (int i = 0; i < len; i++)
+        {
+          if (model[i] == key)
+            {
+              at = i;
+            }
+        }
+      if (at >= 0)
+        {
+          memmove(&model[1], &model[0], at * sizeof(int));
+        }
+      else
+        {
+          memmove(&model[1], &model[0], (len < CAP ? len : CAP - 1) * sizeof(int));
+          len += len < CAP;
+        }
+      model[0] = key;
+
+      if ((seed >> 8) & 1)
+        {
+          int *data = list_lru_get(lru, &key);
+          TEST_ASSERT_EQUAL(at >= 0, data != NULL);
+          if (data == NULL)
+            {
+              list_lru_put(lru, alloc_data(key));
+            }
+        }
+      else
+        {
+          list_lru_put(lru, alloc_data(key));
+        }
+      TEST_ASSERT_EQUAL_size_t(len, list_lru_size(lru));
+    }
+  list_lru_destroy(&lru);
+}
+
+/**
+ * Helper function, copies a cached integer out under the shard lock.
+ */
+static void copy_int(void *data, void *ctx)
+{
+  *(int *)ctx = *(int *)data;
+}
+
+static list_lru_sharded_t *sharded_ = NULL; // Cache shared by the hammer threads
+
+/**
+ * Helper function, thread body mixing gets, puts and removes on sharded_.
+ */
+static void *hammer_sharded(void *arg)
+{
+  unsigned seed = (unsigned)(uintptr_t)arg;
+  for (int op = 0; op < 20000; op++)
+    {
+      seed = seed * 1103515245u + 12345u;
+      int key = (int)((seed >> 16) % 500);
+      int value = -1;
+      switch ((seed >> 8) % 4)
+        {
+        case 0:
+          list_lru_sharded_put(sharded_, alloc_data(key));
+          break;
+        case 1:
+          free(list_lru_sharded_remove(sharded_, &key));
+          break;
+        default:
+          if (list_lru_sharded_get(sharded_, &key, copy_int, &value) == 1 && value != key)
+            {
+              return arg; // Report the corruption to the main thread
+            }
+        }
+    }
+  return NULL;
+}
+
+// Test the sharded cache from several threads
+void test_lru_sharded(void)
+{
+  sharded_ = list_lru_sharded_init(8, 100, hash_int, destroy_data, compare_to);
+  TEST_ASSERT_NOT_NULL(sharded_);
+  pthread_t threads[8];
+  for (uintptr_t i = 0; i < 8; i++)
+    {
+      pthread_create(&threads[i], NULL, hammer_sharded, (void *)(i + 1));
+    }
+  for (int i = 0; i < 8; i++)
+    {
+      void *rval;
+      pthread_join(threads[i], &rval);
+      TEST_ASSERT_NULL(rval);
+    }
+  TEST_ASSERT_TRUE(list_lru_sharded_size(sharded_) <= 100);
+
+  list_lru_stats_t stats;
+  TEST_ASSERT_EQUAL_INT(0, list_lru_sharded_stats(sharded_, &stats));
+  TEST_ASSERT_TRUE(stats.hits > 0);
+  TEST_ASSERT_TRUE(stats.evictions > 0);
+
+  // Single threaded behaviour matches the plain cache
+  int key = 1000;
+  int value = 0;
+  TEST_ASSERT_EQUAL_INT(0, list_lru_sharded_get(sharded_, &key, copy_int, &value));
+  list_lru_sharded_put(sharded_, alloc_data(key));
+  TEST_ASSERT_EQUAL_INT(1, list_lru_sharded_get(sharded_, &key, copy_int, &value));
+  TEST_ASSERT_EQUAL_INT(key, value);
+  int *data = list_lru_sharded_remove(sharded_, &key);
+  TEST_ASSERT_EQUAL_INT(key, *data);
+  free(data);
+
+  list_lru_sharded_destroy(&sharded_);
+  TEST_ASSERT_NULL(sharded_);
+  TEST_ASSERT_NULL(list_lru_sharded_init(8, 4, hash_int, destroy_data, compare_to));
+  TEST_ASSERT_NULL(list_lru_sharded_init(8, 100, hash_int, NULL, compare_to));
+}
+
+// Test the CLOCK policy gives referenced elements a second chance
+void test_lru_clock(void)
+{
+  list_lru_t *lru = list_lru_init(3, hash_int, destroy_data, compare_to);
+  list_lru_set_policy(lru, LIST_LRU_CLOCK);
+  for (int i = 1; i <= 3; i++)
+    {
+      list_lru_put(lru, alloc_data(i));
+    }
+
+  // 1 and 2 are referenced, so 3 goes even though it was added last
+  int key = 1;
+  TEST_ASSERT_NOT_NULL(list_lru_get(lru, &key));
+  key = 2;
+  TEST_ASSERT_NOT_NULL(list_lru_get(lru, &key));
+  list_lru_put(lru, alloc_data(4));
+  key = 3;
+  TEST_ASSERT_NULL(list_lru_get(lru, &key));
+
+  // The sweep cleared the bits and went round 4, so 1 goes next
+  list_lru_put(lru, alloc_data(5));
+  key = 1;
+  TEST_ASSERT_NULL(list_lru_get(lru, &key));
+  for (key = 2; key <= 5; key++)
+    {
+      TEST_ASSERT_EQUAL(key == 2 || key == 4 || key == 5, list_lru_get(lru, &key) != NULL);
+    }
+
+  // Every element referenced: a full sweep, then the oldest goes
+  list_lru_put(lru, alloc_data(6));
+  TEST_ASSERT_EQUAL_size_t(3, list_lru_size(lru));
+  key = 2;
+  TEST_ASSERT_NULL(list_lru_get(lru, &key));
+  key = 6;
+  TEST_ASSERT_NOT_NULL(list_lru_get(lru, &key));
+  list_lru_stats_t stats;
+  list_lru_stats(lru, &stats);
+  TEST_ASSERT_EQUAL_UINT64(3, stats.evictions);
+  list_lru_destroy(&lru);
+}
+
+// Test the sharded cache with CLOCK lookups under shared locks
+void test_lru_sharded_clock(void)
+{
+  sharded_ = list_lru_sharded_init(4, 100, hash_int, destroy_data, compare_to);
+  list_lru_sharded_set_policy(sharded_, LIST_LRU_CLOCK);
+  pthread_t threads[8];
+  for (uintptr_t i = 0; i < 8; i++)
+    {
+      pthread_create(&threads[i], NULL, hammer_sharded, (void *)(i + 1));
+    }
+  for (int i = 0; i < 8; i++)
+    {
+      void *rval;
+      pthread_join(threads[i], &rval);
+      TEST_ASSERT_NULL(rval);
+    }
+  TEST_ASSERT_TRUE(list_lru_sharded_size(sharded_) <= 100);
+  list_lru_sharded_destroy(&sharded_);
+}
+
+// Test the filter never hides an element and rules out most misses
+void test_filter(void)
+{
+  const int n = 2000; // Enough to make the filter grow
+  TEST_ASSERT_EQUAL_INT(0, list_set_hash(lst_, hash_int));
+  for (int i = 0; i < n; i++)
+    {
+      list_add(lst_, alloc_data(2 * i)); // Even numbers only
+    }
+  for (int i = 0; i < n; i += 7)
+    {
+      int key = 2 * i;
+      TEST_ASSERT_EQUAL_INT(n - 1 - i, list_indexof(lst_, &key));
+    }
+#ifdef LIST_STATS
+  list_stats_reset(lst_);
+#endif
+  int misses = 0;
+  for (int i = 0; i < n; i++)
+    {
+      int key = 2 * i + 1;
+      misses += list_indexof(lst_, &key) == -1;
+    }
+  TEST_ASSERT_EQUAL_INT(n, misses);
+#ifdef LIST_STATS
+  list_stats_t stats;
+  list_stats(lst_, &stats);
+  TEST_ASSERT_TRUE(stats.filter_rejects > (uint64_t)n * 9 / 10);
+#endif
+
+  // Removed elements are uncounted, replaced ones swapped
+  int key = 10;
+  free(list_remove_data(lst_, &key));
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, &key));
+  free(list_set(lst_, 0, alloc_data(-5)));
+  key = -5;
+  TEST_ASSERT_EQUAL_INT(0, list_indexof(lst_, &key));
+  list_insert_at(lst_, 3, alloc_data(-7));
+  key = -7;
+  TEST_ASSERT_EQUAL_INT(3, list_indexof(lst_, &key));
+
+  // Both halves of a split and the target of a splice still find everything
+  list_t *rest = list_split_at(lst_, 1000);
+  int moved = (int)rest->size;
+  key = 2;
+  TEST_ASSERT_EQUAL_INT(moved - 2, list_indexof(rest, &key));
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, &key));
+  list_splice(lst_, rest, true);
+  TEST_ASSERT_EQUAL_INT(moved - 2, list_indexof(lst_, &key));
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(rest, &key));
+  list_destroy(&rest);
+  key = -7;
+  TEST_ASSERT_NOT_EQUAL(-1, list_indexof(lst_, &key));
+#ifdef LIST_STATS
+  // The filter is up to date again without a lookup having to rebuild it
+  list_stats_reset(lst_);
+  key = 1;
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, &key));
+  list_stats(lst_, &stats);
+  TEST_ASSERT_EQUAL_UINT64(0, stats.nodes_traversed);
+#endif
+#ifdef LIST_TRACE
+  // A lookup the filter answered is traced as such
+  char path[] = "/tmp/test-lab-filter-trace-XXXXXX";
+  int fd = mkstemp(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  close(fd);
+  TEST_ASSERT_EQUAL_INT(0, list_trace_open(path));
+  key = 1;
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof(lst_, &key));
+  list_trace_close();
+  FILE *in = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(in);
+  list_trace_header_t header;
+  list_trace_record_t rec;
+  TEST_ASSERT_EQUAL_size_t(1, fread(&header, sizeof(header), 1, in));
+  TEST_ASSERT_EQUAL_size_t(1, fread(&rec, sizeof(rec), 1, in));
+  fclose(in);
+  unlink(path);
+  TEST_ASSERT_EQUAL_UINT8(LIST_TRACE_FILTERED, rec.hit);
+  TEST_ASSERT_EQUAL_UINT64(0, rec.traversed);
+#endif
+  key = -7;
+  TEST_ASSERT_NOT_EQUAL(-1, list_indexof_parallel(lst_, &key, 2));
+  key = 1;
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof_parallel(lst_, &key, 2));
+
+  TEST_ASSERT_EQUAL_INT(0, list_set_hash(lst_, NULL));
+  key = 4;
+  TEST_ASSERT_NOT_EQUAL(-1, list_indexof(lst_, &key));
+}
+
+/**
+ * Helper function, looks keys up one at a time to check list_indexof_many.
+ */
+static void check_indexof_many(list_t *lst, int *const *keys, size_t n, uint64_t (*hash)(const void *))
+{
+  int out[64];
+  int expected_found = 0;
+  TEST_ASSERT_TRUE(n <= 64);
+  int found = list_indexof_many(lst, (void *const *)keys, n, hash, out);
+  for (size_t i = 0; i < n; i++)
+    {
+      int expected = keys[i] ? list_indexof(lst, keys[i]) : -1;
+      TEST_ASSERT_EQUAL_INT(expected, out[i]);
+      expected_found += expected != -1;
+    }
+  TEST_ASSERT_EQUAL_INT(expected_found, found);
+}
+
+// Test looking up many keys in one walk, which needs a hash passed in or set on the list
+void test_indexof_many(void)
+{
+  for (int i = 0; i < 500; i++)
+    {
+      list_add(lst_, alloc_data(i % 250)); // Every value twice
+    }
+  int values[] = { 0, 249, 7, 7, 1000, 125, -1, 3 };
+  int *keys[9];
+  for (int i = 0; i < 8; i++)
+    {
+      keys[i] = &values[i];
+    }
+  keys[8] = NULL;
+  int out[2];
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof_many(lst_, (void *const *)keys, 2, NULL, out));
+
+  // A hash passed in works without a filter on the list
+  check_indexof_many(lst_, keys, 9, collide_int); // Long probe runs
+  check_indexof_many(lst_, keys, 9, hash_int);
+  TEST_ASSERT_NULL(lst_->bloom);
+
+  // Or the hash of the list is used, along with its filter
+  TEST_ASSERT_EQUAL_INT(0, list_set_hash(lst_, collide_int));
+  check_indexof_many(lst_, keys, 9, NULL);
+  TEST_ASSERT_EQUAL_INT(0, list_set_hash(lst_, hash_int));
+  check_indexof_many(lst_, keys, 9, NULL);
+  check_indexof_many(lst_, keys, 1, NULL);
+  TEST_ASSERT_EQUAL_INT(0, list_indexof_many(lst_, NULL, 0, NULL, NULL));
+
+  // The list is not reorganized between the keys
+  list_set_policy(lst_, LIST_POLICY_MOVE_TO_FRONT);
+  TEST_ASSERT_EQUAL_INT(2, list_indexof_many(lst_, (void *const *)keys, 2, NULL, out));
+  TEST_ASSERT_EQUAL_INT(249, out[0]);
+  TEST_ASSERT_EQUAL_INT(0, out[1]);
+  TEST_ASSERT_EQUAL_INT(-1, list_indexof_many(NULL, (void *const *)keys, 2, hash_int, out));
+}
+
+// Test removing many positions in one walk
+void test_remove_indices(void)
+{
+  for (int i = 0; i < 10; i++)
+    {
+      list_insert_at(lst_, lst_->size, alloc_data(i)); // List is 0 ... 9
+    }
+
+  size_t indices[] = { 0, 3, 4, 9 };
+  void *out[4];
+  TEST_ASSERT_EQUAL_INT(4, list_remove_indices(lst_, indices, 4, out));
+  int removed[] = { 0, 3, 4, 9 };
+  for (int i = 0; i < 4; i++)
+    {
+      TEST_ASSERT_EQUAL_INT(removed[i], *(int *)out[i]);
+      free(out[i]);
+    }
+  int left[] = { 1, 2, 5, 6, 7, 8 };
+  assert_list_equals(lst_, left, 6);
+
+  // Bad positions leave the list untouched
+  size_t unsorted[] = { 2, 1 };
+  size_t repeated[] = { 1, 1 };
+  size_t beyond[] = { 1, 6 };
+  TEST_ASSERT_EQUAL_INT(-1, list_remove_indices(lst_, unsorted, 2, out));
+  TEST_ASSERT_EQUAL_INT(-1, list_remove_indices(lst_, repeated, 2, out));
+  TEST_ASSERT_EQUAL_INT(-1, list_remove_indices(lst_, beyond, 2, out));
+  assert_list_equals(lst_, left, 6);
+  TEST_ASSERT_EQUAL_INT(0, list_remove_indices(lst_, NULL, 0, out));
+  TEST_ASSERT_EQUAL_INT(-1, list_remove_indices(lst_, beyond, (size_t)INT_MAX + 1, out)); // Count would not fit
+  size_t fine[] = { 0, 1 };
+  lst_->destroy_data = NULL; // Nothing to destroy the data with
+  TEST_ASSERT_EQUAL_INT(-1, list_remove_indices(lst_, fine, 2, NULL));
+  assert_list_equals(lst_, left, 6);
+
+  // Without out_data the data is destroyed, positions near the back start from there
+  lst_->destroy_data = counting_destroy;
+  destroyed_ = 0;
+  size_t back[] = { 4, 5 };
+  TEST_ASSERT_EQUAL_INT(2, list_remove_indices(lst_, back, 2, NULL));
+  TEST_ASSERT_EQUAL_INT(2, destroyed_);
+  int front[] = { 1, 2, 5, 6 };
+  assert_list_equals(lst_, front, 4);
+}
+
 int main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_create_destroy);
@@ -375,5 +2178,54 @@ int main(void) {
   RUN_TEST(test_next_data);
   RUN_TEST(test_prev_data);
   RUN_TEST(test_circular_structure);
+  RUN_TEST(test_init_oom_list);
+  RUN_TEST(test_init_oom_sentinel);
+  RUN_TEST(test_add_oom);
+  RUN_TEST(test_destroy_async);
+  RUN_TEST(test_reclaimer_restart);
+  RUN_TEST(test_destroy_async_stopped);
+  RUN_TEST(test_memory_stats);
+#ifdef LIST_STATS
+  RUN_TEST(test_stats_counters);
+  RUN_TEST(test_stats_dump);
+#endif
+  RUN_TEST(test_policy_move_to_front);
+  RUN_TEST(test_policy_transpose);
+  RUN_TEST(test_policy_frequency);
+#ifdef LIST_TRACE
+  RUN_TEST(test_trace_capture);
+#endif
+  RUN_TEST(test_trace_read);
+  RUN_TEST(test_save_load);
+  RUN_TEST(test_load_corrupt);
+  RUN_TEST(test_view);
+  RUN_TEST(test_foreach);
+  RUN_TEST(test_long_list_walks);
+  RUN_TEST(test_jump_index_opt_in);
+  RUN_TEST(test_compact);
+  RUN_TEST(test_compact_step);
+  RUN_TEST(test_indexof_parallel);
+  RUN_TEST(test_destroy_parallel);
+  RUN_TEST(test_map_reduce);
+  RUN_TEST(test_map_reduce_parallel);
+  RUN_TEST(test_parallel_after_changes);
+  RUN_TEST(test_executor);
+  RUN_TEST(test_splice_concat);
+  RUN_TEST(test_split);
+  RUN_TEST(test_split_large);
+  RUN_TEST(test_insert_get_set);
+  RUN_TEST(test_get_large);
+  RUN_TEST(test_remove_data_node);
+  RUN_TEST(test_handles);
+  RUN_TEST(test_handles_split_splice);
+  RUN_TEST(test_handles_oom);
+  RUN_TEST(test_lru);
+  RUN_TEST(test_lru_model);
+  RUN_TEST(test_lru_sharded);
+  RUN_TEST(test_lru_clock);
+  RUN_TEST(test_lru_sharded_clock);
+  RUN_TEST(test_filter);
+  RUN_TEST(test_indexof_many);
+  RUN_TEST(test_remove_indices);
   return UNITY_END();
 }
\ No newline at end of file